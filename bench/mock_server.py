@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Stand-in for the transcription endpoint, for benchmarks.
+
+Accepts the same multipart POST as /v1/audio/transcriptions (fixed-length or
+chunked), reads the body at a capped bandwidth, waits a configurable latency
+and answers with a verbose_json-shaped response. Nothing is transcribed: the
+text just reports how much audio arrived.
+
+    bench/mock_server.py --port 8089 --latency-ms 300 --bandwidth 200000
+"""
+import argparse
+import json
+import random
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def parse_args():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument('--port', type=int, default=8089)
+    p.add_argument('--latency-ms', type=float, default=0,
+                   help='delay between the last request byte and the response')
+    p.add_argument('--jitter-ms', type=float, default=0,
+                   help='add a uniform random 0..N ms to the latency')
+    p.add_argument('--bandwidth', type=float, default=0,
+                   help='upload bytes per second (0 = unlimited)')
+    p.add_argument('--fail-rate', type=float, default=0,
+                   help='fraction of requests answered with 503')
+    p.add_argument('--text', default=None, help='fixed transcript to return')
+    return p.parse_args()
+
+
+ARGS = parse_args()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, fmt, *args):
+        sys.stderr.write('mock: ' + fmt % args + '\n')
+
+    def read_throttled(self, n):
+        data = bytearray()
+        start = time.monotonic()
+        while len(data) < n:
+            chunk = self.rfile.read(min(16384, n - len(data)))
+            if not chunk:
+                break
+            data += chunk
+            if ARGS.bandwidth > 0:
+                ahead = len(data) / ARGS.bandwidth - (time.monotonic() - start)
+                if ahead > 0:
+                    time.sleep(ahead)
+        return bytes(data)
+
+    def read_body(self):
+        if self.headers.get('Transfer-Encoding', '').lower() == 'chunked':
+            body = bytearray()
+            while True:
+                size = int(self.rfile.readline().split(b';')[0].strip() or b'0', 16)
+                if size == 0:
+                    while self.rfile.readline() not in (b'\r\n', b'\n', b''):
+                        pass
+                    return bytes(body)
+                body += self.read_throttled(size)
+                self.rfile.readline()
+        return self.read_throttled(int(self.headers.get('Content-Length', 0)))
+
+    def reply(self, code, payload):
+        body = json.dumps(payload).encode()
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        if self.command != 'HEAD':
+            self.wfile.write(body)
+
+    def do_HEAD(self):
+        # The client's pre-connect; any answer will do
+        self.reply(200, {})
+
+    def do_POST(self):
+        body = self.read_body()
+        delay = ARGS.latency_ms + random.uniform(0, ARGS.jitter_ms)
+        time.sleep(delay / 1000)
+        if random.random() < ARGS.fail_rate:
+            self.reply(503, {'error': {'message': 'mock failure'}})
+            return
+        text = ARGS.text or 'mock transcript of %d bytes' % len(body)
+        self.reply(200, {
+            'task': 'transcribe',
+            'language': 'english',
+            'duration': 0.0,
+            'text': text,
+            'segments': [{'id': 0, 'start': 0.0, 'end': 0.0, 'text': text, 'no_speech_prob': 0.0}],
+        })
+
+
+if __name__ == '__main__':
+    server = ThreadingHTTPServer(('127.0.0.1', ARGS.port), Handler)
+    server.daemon_threads = True
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
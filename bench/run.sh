@@ -0,0 +1,53 @@
+#!/bin/sh
+# Replay WAV fixtures through voice-transcribe against the mock endpoint and
+# print one JSON result per fixture, then p50/p95 of the main numbers.
+#
+#   bench/run.sh [--fast] fixture.wav... [-- KEY=VALUE...]
+#
+# Environment: BIN (default ./voice-transcribe), PORT (8089), LATENCY_MS (300),
+# BANDWIDTH in bytes/s (0 = unlimited), RUNS per fixture (1).
+set -eu
+
+BIN=${BIN:-./voice-transcribe}
+PORT=${PORT:-8089}
+LATENCY_MS=${LATENCY_MS:-300}
+BANDWIDTH=${BANDWIDTH:-0}
+RUNS=${RUNS:-1}
+HERE=$(dirname "$0")
+
+FAST=
+if [ "${1:-}" = "--fast" ]; then FAST=--fast; shift; fi
+FIXTURES=
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do FIXTURES="$FIXTURES $1"; shift; done
+[ "${1:-}" = "--" ] && shift
+[ -n "$FIXTURES" ] || { echo "usage: $0 [--fast] fixture.wav... [-- KEY=VALUE...]" >&2; exit 2; }
+
+python3 "$HERE/mock_server.py" --port "$PORT" --latency-ms "$LATENCY_MS" --bandwidth "$BANDWIDTH" 2>/dev/null &
+MOCK=$!
+trap 'kill $MOCK 2>/dev/null' EXIT
+sleep 0.5
+
+RESULTS=$(mktemp)
+for fixture in $FIXTURES; do
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$BIN" --replay "$fixture" $FAST OPENAI_API_KEY=bench PRECONNECT=1 \
+            "API_URL=http://127.0.0.1:$PORT/v1/audio/transcriptions" "$@" | tee -a "$RESULTS"
+        i=$((i + 1))
+    done
+done
+
+python3 - "$RESULTS" <<'PY'
+import json, sys
+rows = [json.loads(line) for line in open(sys.argv[1]) if line.strip()]
+def pct(values, p):
+    values = sorted(values)
+    return values[max(0, -(-len(values) * p // 100) - 1)]
+print('\n%-18s %6s %10s %10s' % ('metric', 'n', 'p50', 'p95'))
+for key in ('stop_to_clipboard', 'first_byte', 'last_byte', 'uploaded_bytes',
+            'capture_cpu_us', 'process_cpu_us', 'peak_rss_kb'):
+    values = [r[key] for r in rows if key in r]
+    if values:
+        print('%-18s %6d %10d %10d' % (key, len(values), pct(values, 50), pct(values, 95)))
+PY
+rm -f "$RESULTS"
@@ -3,27 +3,112 @@
  * Runs in background without stealing focus
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <poll.h>
+#include <dirent.h>
 #include <alsa/asoundlib.h>
 #include <curl/curl.h>
 #include <math.h>
+#include <stdatomic.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#ifdef HAVE_FLAC
+#include <FLAC/stream_encoder.h>
+#endif
+#ifdef HAVE_OPUS
+#include <opus/opusenc.h>
+#endif
+#ifdef HAVE_WHISPER
+#include <whisper.h>
+#endif
+#ifdef HAVE_PIPEWIRE
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#endif
+#ifdef HAVE_WAYLAND
+#include <wayland-client.h>
+#include "wlr-data-control-unstable-v1-client-protocol.h"
+#include "virtual-keyboard-unstable-v1-client-protocol.h"
+#endif
 
 #define SAMPLE_RATE 16000
 #define CHANNELS 1
 #define BUFFER_SIZE 4096
+#define PERIOD_FRAMES 1024                    // default ALSA period: 64 ms at 16 kHz
+#define PERIODS_PER_BUFFER 8
+#define CAPTURE_FALLBACK_RATE 48000           // asked for when the device can't do SAMPLE_RATE itself
+#define CAPTURE_MAX_CHANNELS 8
+#define RESAMPLER_TAPS 32                     // filter taps per phase, times the decimation factor
+#define RESAMPLER_MAX_TAPS 256
+#define CAPTURE_POLL_TIMEOUT_MS 500
 #define MAX_RECORDING_TIME 300
 #define PIDFILE "/tmp/voice_transcribe.pid"
-#define STATUSFILE "/tmp/voice_transcribe.status"
+#define STATUS_SHM "/voice_transcribe.status"   // shm_open name, i.e. /dev/shm/voice_transcribe.status
+#define STATUS_MAGIC 0x54535456u             // "VTST"
+#define STATUS_VERSION 2
+#define STATUS_HISTORY 64                    // recent level samples kept for the overlay
+#define STATUS_MESSAGE 64
+#define STATUS_PARTIAL 1024                  // tail of the live transcript shown while recording
+#define STREAM_QUEUE_SLOTS 64                // ~16 s of BUFFER_SIZE periods in flight
+#define CAPTURE_RING_SLOTS 64                // captured periods waiting for the processing thread
+#define SESSION_SLOTS 4                      // daemon sessions recording or still finishing
+#define WAV_STREAMING_SIZE 0xFFFFFFFFu       // RIFF/data size placeholder for unknown length
+#define SEGMENT_WORKERS 3                     // concurrent segment requests
+#define SEGMENT_SILENCE_LEVEL 0.05f           // peak level below which a period counts as quiet
+#define LIVE_SEGMENT_SECONDS 5                // segment length when LIVE_TRANSCRIPT is on
+#define SEGMENT_MIN_SILENCE_MS 300            // quiet run needed before cutting a segment
+#define PREROLL_MS 1500                       // default pre-roll kept by the daemon
+#define MAX_PREROLL_MS 10000
+#define VAD_FRAME 320                         // 20 ms analysis frames
+#define VAD_PAD_FRAMES 15                     // silence kept before speech onset (300 ms)
+#define VAD_MAX_SILENCE_MS 700                // longer pauses are shortened to this
+#define VAD_THRESHOLD_DB 8.0f                 // speech must be this far above the noise floor
+#define VAD_MIN_RMS 150.0f                    // ...and above this absolute level
+#define STREAM_SLOT_BYTES (BUFFER_SIZE * 2)
+#define OPUS_BITRATE 24000                    // default Opus bitrate, plenty for speech
+#define TRANSCRIPTION_URL "https://api.openai.com/v1/audio/transcriptions"
+#define TRANSCRIPTION_MODEL "whisper-1"
+#define CONNECT_TIMEOUT_MS 5000
+#define STALL_TIMEOUT_S 60                    // abort when nothing moves either way for this long
+#define REQUEST_BASE_TIMEOUT_MS 30000         // total timeout = base + body at the floor rate below
+#define UPLOAD_FLOOR_BYTES_PER_S 50000
+#define UPLOAD_RETRIES 3
+#define RETRY_BASE_MS 500                     // doubled per attempt, plus jitter
+#define RETRY_MAX_MS 8000
+#define SPOOL_MAGIC "VTSPOOL1"
+#define SPOOL_RETRY_S 30                      // first drain retry while offline, doubled up to the max
+#define SPOOL_MAX_RETRY_S 600
+#define TIMING_LOG_MAX_BYTES (512 * 1024)     // timings.jsonl is rotated to timings.jsonl.1 past this
+#define STATS_SESSIONS 100                    // --stats summarizes this many recent sessions
+#define TRANSCRIPT_CACHE_MAX_BYTES (1 << 20)  // larger cache files are ignored as corrupt
+#define HISTORY_MAGIC "VTHIST01"
+#define HISTORY_ROWS 20                       // --history prints this many by default
+#define TYPE_KEYMAP_KEYS 240                  // distinct characters per virtual-keyboard keymap
+#define JSON_MAX_DEPTH 16
+#define AUDIO_BLOCK_BYTES (64 * 1024)         // 2 s of 16 kHz mono per recording block
 
 typedef struct {
     void *data;
@@ -31,36 +116,824 @@ typedef struct {
     size_t capacity;
 } AudioBuffer;
 
+// A recording as a list of fixed-size blocks: appending never moves what is already
+// stored, so readers on other threads can use any range below a published size.
+// The block table is sized for the longest possible recording when the session starts.
 typedef struct {
-    char *data;
-    size_t size;
+    char **blocks;
+    size_t max_blocks;
+    size_t size;            // bytes stored
+    int overflow;           // an append failed; logged once
+} AudioStore;
+
+// One entry of a verbose_json "segments" array
+typedef struct {
+    double start;           // seconds
+    double end;
+    size_t text;            // offset into the response arena
+} ResponseSegment;
+
+// Transcription response, parsed as it arrives. Strings from the fields we care
+// about are decoded into one arena sized from Content-Length; the raw body is not kept.
+typedef struct {
+    CURL *curl;             // to read Content-Length on the first chunk
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    long text;              // arena offsets, -1 when absent
+    long language;
+    long error_message;
+    double duration;
+    ResponseSegment *segments;
+    size_t segment_count;
+    size_t segment_cap;
+
+    // Tokenizer state
+    int state;
+    int field;              // what the value being parsed is for
+    int string_start;       // arena offset of the string being decoded, -1 if skipped
+    int depth;
+    unsigned char stack[JSON_MAX_DEPTH];   // container kind, '{' or '['
+    unsigned char ctx[JSON_MAX_DEPTH];     // JsonField the container was opened for
+    char key[32];
+    size_t key_len;
+    char num[32];
+    size_t num_len;
+    uint32_t hex;
+    int hex_digits;
+    uint32_t high_surrogate;
+    int failed;
 } CurlResponse;
 
-static AudioBuffer g_audio_buffer = {0};
+typedef struct {
+    char riff[4];
+    uint32_t size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+    char data[4];
+    uint32_t data_size;
+} __attribute__((packed)) WavHeader;
+
+// Upload formats. WAV is sent as-is; the others compress incrementally as periods
+// arrive, so the upload after stop is already encoded.
+typedef struct Encoder Encoder;
+
+typedef struct {
+    const char *name;       // UPLOAD_FORMAT value
+    const char *filename;   // multipart filename; the API goes by the extension
+    const char *mime_type;
+    int (*init)(Encoder *enc);
+    int (*encode)(Encoder *enc, const short *pcm, size_t frames);
+    int (*finish)(Encoder *enc);
+    void (*destroy)(Encoder *enc);
+} EncoderType;
+
+struct Encoder {
+    const EncoderType *type;
+    AudioBuffer out;        // encoded bytes produced so far
+    size_t streamed;        // bytes of out already handed to the streaming upload
+    void *codec;
+#ifdef HAVE_OPUS
+    OggOpusComments *comments;
+#endif
+};
+
+// Sample kernels for the capture path, picked once at startup for the CPU we run on
+typedef struct {
+    const char *name;
+    int (*peak)(const short *x, size_t n);                  // max |x|, 0..32768
+    uint64_t (*sum_squares)(const short *x, size_t n);
+    void (*to_float)(const short *x, float *out, size_t n); // scaled to [-1, 1)
+    void (*gain)(short *x, size_t n, int gain_q12);         // x * gain / 4096, saturated; gain <= 32767
+    float (*dot)(const float *x, const float *h, size_t n); // resampler filter taps
+} DspKernels;
+
+typedef struct SessionTiming SessionTiming;
+
+// A speech-to-text engine; transcribe() gets a whole 16 kHz mono recording and
+// the session's timing to account uploads in
+typedef struct {
+    const char *name;
+    int remote;             // uploads over HTTP, so streaming, segments and encoders apply
+    int (*load)(void);      // one-time setup; daemon mode does it at startup and keeps it
+    int (*transcribe)(const AudioStore *audio, SessionTiming *timing, char **result);
+    void (*evict)(void);    // drop what load() built after a long idle; load() brings it back
+    void (*unload)(void);
+} TranscriberBackend;
+
+// Where audio comes from. Every source delivers the pipeline format (16 kHz mono
+// S16) in reads of at most BUFFER_SIZE frames; one source is open at a time.
+typedef struct {
+    const char *name;
+    int (*open)(void);                          // 0, or a negative errno; ready for start()
+    void (*start)(void);
+    int (*read)(short *buffer, int timeout_ms); // frames, 0 on timeout or a stop request, <0 error
+    int (*read_nowait)(short *buffer);          // frames, or -EAGAIN once nothing is buffered
+    void (*stop)(void);                         // discard buffered audio; start() resumes
+    void (*close)(void);
+} CaptureSource;
+
+// Energy / zero-crossing voice activity detector, run as a gate on the capture
+// path: speech and short pauses pass, long silences are cut down to
+// VAD_MAX_SILENCE_MS, and a short pad of the preceding silence is re-inserted at
+// each speech onset so word beginnings survive.
+typedef struct {
+    short frame[VAD_FRAME];             // analysis frame being filled
+    size_t frame_fill;
+    short pad[VAD_PAD_FRAMES][VAD_FRAME];
+    size_t pad_head, pad_count;
+    short out[BUFFER_SIZE];             // kept audio waiting to be passed on
+    size_t out_count;
+    float noise_floor;                  // mean square energy of the background
+    int silence_run;                    // consecutive non-speech frames
+    int emitting;
+    size_t speech_frames;
+} Vad;
+
+// Last few seconds of capture, continuously overwritten by the daemon's capture
+// thread. The writer publishes the running frame count with release ordering, so
+// readers can copy without a lock and detect frames overwritten mid-copy.
+typedef struct {
+    short *samples;
+    size_t capacity;            // frames
+    _Atomic uint64_t written;   // total frames ever written
+} PrerollRing;
+
+// Captured periods on their way from the thread reading the device to the session's
+// processing thread (gain, meter, VAD, store, encoder, uploads). Single producer,
+// single consumer and lock-free: the producer fills the slot at head and publishes
+// it with a release store, the consumer acquires head and returns slots by
+// advancing tail. A full ring drops the period rather than stall the device.
+typedef struct {
+    short slots[CAPTURE_RING_SLOTS][BUFFER_SIZE];
+    int frames[CAPTURE_RING_SLOTS];
+    _Atomic size_t head;        // slots ever published
+    _Atomic size_t tail;        // slots ever consumed
+    atomic_int closed;          // the producer is done; drain, then stop
+    _Atomic uint64_t dropped;   // frames lost to a full ring
+    int wake_fd;                // eventfd the consumer sleeps on
+} CaptureRing;
+
+// Device-native capture turned into the pipeline's 16 kHz mono S16: channels are
+// averaged, then a polyphase windowed-sinc filter resamples by any rational ratio.
+// A device that already delivers the pipeline format passes straight through.
+typedef struct {
+    int passthrough;
+    unsigned rate, channels;
+    int sample_bytes;           // 2 (S16_LE) or 4 (S32_LE)
+    size_t max_read;            // device frames per read that fit one output period
+    void *raw;                  // one read in device format
+    float *mono;                // taps-1 frames of history, then the newest read
+    unsigned up, down;          // SAMPLE_RATE / rate in lowest terms
+    size_t taps;                // per phase
+    float *filter;              // up phases of taps coefficients, stored reversed
+    uint64_t pos;               // next output's input position, in 1/up frames
+} CaptureConverter;
+
+// A capture setup that worked, cached so later starts open it without probing
+typedef struct {
+    char device[64];
+    unsigned rate, channels;
+    snd_pcm_format_t format;
+} CaptureParams;
+
+// One transcript cache file and when it was last used
+typedef struct {
+    struct timespec used;
+    char name[20];
+} CacheEntry;
+
+// History index: a header, then one fixed-size entry per transcript, appended in
+// delivery order. The texts themselves are in history.log, each followed by a newline.
+typedef struct {
+    char magic[8];              // HISTORY_MAGIC
+    uint32_t entry_size;        // sizeof(HistoryEntry)
+    uint32_t reserved;
+} HistoryHeader;
+
+typedef struct {
+    int64_t time;               // unix time of the recording
+    uint64_t offset;            // text position in history.log
+    uint32_t length;            // text bytes, without the newline
+    uint32_t audio_ms;          // recording length after VAD
+    uint32_t latency_ms;        // stop to clipboard; 0 when not measured
+    uint32_t flags;             // HISTORY_SPOOLED
+    char model[32];             // model that transcribed it
+} HistoryEntry;
+
+#define HISTORY_SPOOLED 1       // delivered late from the offline spool
+
+// Where one upload's time went, from curl's clock; all but start_ms are ms after the start
+typedef struct {
+    uint64_t start_ms;          // CLOCK_MONOTONIC; 0 if no upload completed
+    uint64_t connect, tls, first_byte, last_byte;
+} TransferTimes;
+
+// Milestones of one session in CLOCK_MONOTONIC ms (0 = didn't happen). The timing
+// log stores them as offsets from the trigger.
+struct SessionTiming {
+    uint64_t trigger;           // process start, or the daemon receiving the toggle
+    uint64_t device_open;       // capture device ready (attach time in daemon mode)
+    uint64_t first_frame;       // first period reached the processing thread
+    uint64_t stop;              // stop requested
+    uint64_t captured;          // capture finished
+    uint64_t encoded;           // encoder flushed, request body complete
+    TransferTimes upload;       // the last upload that returned a transcript
+    uint64_t transcribed;       // transcript in hand
+    uint64_t clipboard;         // clipboard write done
+    uint64_t audio_ms;          // recording length after VAD
+    _Atomic uint64_t uploaded;  // request body bytes handed to curl, retries included
+    uint64_t capture_cpu_us;    // CPU time of the thread reading the device
+    uint64_t process_cpu_us;    // and of the thread processing what it read
+};
+
+// --replay: a WAV fixture stands in for the microphone, for benchmarks
+typedef struct {
+    short *pcm;                 // NULL: capture from ALSA
+    size_t frames;
+    const char *path;
+    int realtime;               // pace periods at the recording's own speed
+    char *result;               // the transcript, reported instead of copied
+} ReplaySource;
+
+// Bounded queue of upload bytes (PCM or encoder output) from the recording thread to the streaming upload.
+// The producer never blocks: if the upload falls behind, the queue overflows and
+// the stream is abandoned in favour of the buffered upload after stop.
+typedef struct {
+    char data[STREAM_QUEUE_SLOTS][STREAM_SLOT_BYTES];
+    size_t bytes[STREAM_QUEUE_SLOTS];
+    size_t head, tail, count;
+    size_t read_offset;     // bytes of the head slot already handed to curl
+    int closed;
+    int overflow;
+    int paused;             // the reader found it empty and paused the transfer
+    CURLM *multi;           // the upload's multi handle, woken whenever there is news
+    pthread_mutex_t lock;
+} StreamQueue;
+
+// In-memory request body handed to curl through a read callback, without copying:
+// an optional head (the WAV header) followed by the caller's buffer, or by a range
+// of an AudioStore when store is set
+typedef struct {
+    const char *head;
+    size_t head_size;
+    const char *data;
+    const AudioStore *store;
+    size_t store_offset;
+    size_t size;
+    size_t offset;          // position in head + data
+    _Atomic uint64_t *uploaded; // a session's body byte count to add to, or NULL
+} MemReader;
+
+typedef struct {
+    CURL *curl;
+    curl_mime *mime;
+    struct curl_slist *headers;
+    CurlResponse response;
+} TranscribeRequest;
+
+// One closed piece of a long recording, uploaded on its own
+typedef struct {
+    size_t pcm_offset;      // range of the session's audio; uploaded from there as WAV without copying
+    size_t pcm_size;
+    WavHeader wav;
+    char *body;             // the encoded file instead, when UPLOAD_FORMAT compresses
+    size_t size;
+    const EncoderType *format;
+    MemReader reader;
+    TranscribeRequest req;
+    char *text;
+    int status;             // 0 pending, 1 transcribed, -1 failed
+    int attempts;           // uploads started so far
+    int retries;            // allowed after the first; none when already offline
+    uint64_t retry_at_ms;   // waiting to be sent again at this time; 0 otherwise
+} Segment;
+
+typedef struct Session Session;
+
+typedef struct {
+    Session *session;
+    Segment **items;
+    size_t count;
+    size_t capacity;
+    size_t next_submit;
+    size_t cut_offset;      // byte offset in the audio where the open segment starts
+    size_t quiet_frames;
+    size_t published;       // leading segments already shown as the live transcript
+    int closed;
+    int cancelled;          // the result is no longer wanted: abandon what is in flight
+    int active;
+    CURLM *multi;
+    pthread_t thread;
+    pthread_mutex_t lock;
+} SegmentPipeline;
+
+typedef struct {
+    Session *session;
+    StreamQueue queue;
+    WavHeader header;
+    size_t header_size;     // 0 when an encoder writes its own container header
+    size_t header_sent;
+    pthread_t thread;
+    int active;
+    int status;
+    char *result;
+} StreamUpload;
+
+// One recording, from trigger to delivered transcript. Only one session captures at
+// a time, but in daemon mode earlier ones may still be uploading while the next is
+// recorded, so everything the upload and delivery side needs lives here.
+struct Session {
+    AudioStore audio;
+    Encoder *encoder;           // incremental encoder, unless segments encode their own
+    StreamUpload stream;
+    SegmentPipeline segments;
+    SessionTiming timing;
+    pthread_t warmup_thread;
+    int warmup_running;
+    uint64_t seq;               // transcripts are delivered in this order
+};
+
+// What the overlay shows; values are part of the shared layout below
+typedef enum {
+    STATUS_IDLE,
+    STATUS_CONNECTING,
+    STATUS_READY,           // no longer shown; kept so later values stay put
+    STATUS_RECORDING,
+    STATUS_PROCESSING,
+    STATUS_UPLOADING,
+    STATUS_COPIED,
+    STATUS_FAILED,
+    STATUS_NO_AUDIO,
+    STATUS_MAX_TIME,
+    STATUS_ERROR,
+    STATUS_TRANSCRIBING,                     // local backend busy
+    STATUS_SPOOLED                           // upload failed, recording saved for a later retry
+} StatusState;
+
+// Status page shared with the overlay through /dev/shm. Every field is 4 bytes
+// so the layout is exactly struct.unpack_from('<IIIIfII64f64s1024s') on the Python side.
+// seq is a seqlock: odd while a write is in progress, readers retry if it moved.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t seq;
+    uint32_t state;                          // StatusState
+    float level;                             // latest peak, 0..1
+    uint32_t elapsed_ms;                     // since the session started
+    uint32_t history_head;                   // levels pushed so far; newest at (head - 1) % STATUS_HISTORY
+    float history[STATUS_HISTORY];
+    char message[STATUS_MESSAGE];            // detail for STATUS_ERROR, otherwise empty
+    char partial[STATUS_PARTIAL];            // live transcript so far (its last bytes if longer)
+} StatusBlock;
+
 static pthread_t g_record_thread;
-static pthread_t g_monitor_thread;
-static volatile int g_stop_recording = 0;
+static atomic_int g_stop_recording = 0;
+static int g_wakeup_fd = -1;                 // eventfd that interrupts a capture poll() on stop
+static int g_period_frames = PERIOD_FRAMES;
 static char *g_api_key = NULL;
-static time_t g_record_start_time;
-static FILE *g_status_file = NULL;
-static float g_current_level = 0.0f;
+static _Atomic uint64_t g_record_start_ms;  // CLOCK_MONOTONIC; read by the capture and status writers
+static StatusBlock *g_status = NULL;
+static pthread_mutex_t g_status_lock = PTHREAD_MUTEX_INITIALIZER; // one writer at a time
+static pid_t g_overlay_pid = -1;
+static int g_overlay_persistent = 0;        // daemon mode: one overlay for every session
+static int g_stream_upload = 0;
+static int g_segment_seconds = 0;
+static int g_live_transcript = 0;
+static const TranscriberBackend *g_backend = NULL; // NULL until settings are loaded; then never NULL
+static char *g_whisper_model = NULL;
+static char *g_whisper_language = NULL;
+static int g_whisper_threads = 0;            // 0 = one per online CPU
+static int g_whisper_gpu = 1;
+static int g_upload_retries = UPLOAD_RETRIES;
+static int g_hedge_after_ms = 0;             // second request when the first is this slow (0 = off)
+static atomic_int g_offline = 0;             // the last upload failed for network reasons
+static int g_spool_enabled = 1;
+static int g_spool_to_clipboard = 0;         // deliver drained transcripts to the clipboard, not history
+static pthread_t g_spool_thread;
+static int g_spool_running = 0;
+static int g_spool_kicked = 0;
+static atomic_int g_spool_pending = 0;       // spool may hold recordings the worker couldn't send yet
+static pthread_mutex_t g_spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_spool_cond = PTHREAD_COND_INITIALIZER;
+static int g_backend_idle_minutes = 15;      // daemon: evict the model after this long unused (0 = never)
+static pthread_t g_backend_thread;
+static int g_backend_loading = 0;
+static uint64_t g_backend_used_ms = 0;
+static int g_max_recording_time = MAX_RECORDING_TIME;
+
+// Daemon mode: one process owns the prepared capture device and a warm curl handle
+enum { SESSION_IDLE, SESSION_RECORDING, SESSION_PROCESSING };
+static atomic_int g_session_state = SESSION_IDLE;
+static atomic_int g_daemon_quit = 0;
+static CURL *g_curl = NULL;
+static CURLSH *g_share = NULL;
+static pthread_mutex_t g_share_locks[CURL_LOCK_DATA_LAST];
+static int g_preconnect = 1;
+static int g_preroll_ms = PREROLL_MS;
+static PrerollRing g_preroll = {0};
+static pthread_t g_preroll_thread;
+static int g_preroll_running = 0;
+static atomic_int g_capture_attached = 0;   // a session is taking periods from the capture thread
+static CaptureRing g_capture_ring = { .wake_fd = -1 };
+static CaptureConverter g_converter = { .passthrough = 1 };
+static const CaptureSource *g_capture = NULL;  // the open source; NULL while none is
+static char *g_capture_backend = NULL;         // CAPTURE_BACKEND; NULL: the first that opens
+static snd_pcm_t *g_alsa_pcm = NULL;
+static char *g_capture_device = NULL;        // NULL: probe hw:0,0, plughw:0,0, default
+static unsigned g_capture_rate = 0;          // 0: 16 kHz if the device has it, else near 48 kHz
+static Session *g_session = NULL;            // the session capturing now; NULL between recordings
+static _Atomic uint64_t g_stop_ms = 0;       // the capturing session's stop request, from request_stop()
+static atomic_ulong g_session_seq = 0;       // seq of the newest session, which owns the status page
+static uint64_t g_delivered_seq = 0;         // last session whose transcript went out
+static int g_sessions_active = 0;            // daemon: session threads still running
+static pthread_mutex_t g_session_lock = PTHREAD_MUTEX_INITIALIZER; // guards the two above
+static pthread_cond_t g_session_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t g_curl_lock = PTHREAD_MUTEX_INITIALIZER;    // one session at a time on g_curl
+static pthread_mutex_t g_backend_lock = PTHREAD_MUTEX_INITIALIZER; // load, transcribe and evict
+static uint64_t g_trigger_ms = 0;
+static int g_timing_log = 1;
+static size_t g_transcript_cache = 0;       // TRANSCRIPT_CACHE entries kept (0 = no cache)
+static int g_history = 1;                   // HISTORY: keep every transcript for --history/--search
+static char *g_last_transcript = NULL;      // daemon: the latest result, for recopy
+static pthread_mutex_t g_last_lock = PTHREAD_MUTEX_INITIALIZER;
+enum { OUTPUT_CLIPBOARD = 1, OUTPUT_TYPE = 2 };
+static int g_output = OUTPUT_CLIPBOARD;      // OUTPUT: clipboard, type or both
+static ReplaySource g_replay = { .realtime = 1 };
+static const char g_default_api_url[] = TRANSCRIPTION_URL;
+static const char g_default_api_model[] = TRANSCRIPTION_MODEL;
+static const char *g_api_url = g_default_api_url;     // API_URL; strdup'ed once set
+static const char *g_api_model = g_default_api_model; // API_MODEL; strdup'ed once set
+
+static const EncoderType *g_upload_format = NULL;   // NULL: plain WAV
+static int g_opus_bitrate = OPUS_BITRATE;
+static const DspKernels *g_dsp = NULL;
+static float g_input_gain_db = 0.0f;
+static int g_input_gain_q12 = 4096;
+static int g_vad_enabled = 0;
+static int g_vad_max_silence_ms = VAD_MAX_SILENCE_MS;
+static float g_vad_threshold_db = VAD_THRESHOLD_DB;
+static Vad g_vad;
+
+static void segment_pipeline_feed(SegmentPipeline *sp, int frames, float level);
+
+// Streaming JSON tokenizer for transcription responses. It accepts any valid
+// JSON, decodes \uXXXX escapes (surrogate pairs included) to UTF-8, and keeps
+// the top-level text/language/duration, verbose_json segments and error.message.
+enum {
+    JSON_VALUE, JSON_VALUE_OR_END, JSON_KEY_OR_END, JSON_KEY_START, JSON_KEY, JSON_KEY_ESCAPE,
+    JSON_COLON, JSON_STRING, JSON_ESCAPE, JSON_UNICODE, JSON_NUMBER, JSON_LITERAL,
+    JSON_AFTER_VALUE, JSON_DONE
+};
+
+typedef enum {
+    FIELD_NONE, FIELD_ROOT, FIELD_TEXT, FIELD_LANGUAGE, FIELD_DURATION, FIELD_SEGMENTS, FIELD_SEGMENT,
+    FIELD_SEGMENT_START, FIELD_SEGMENT_END, FIELD_SEGMENT_TEXT, FIELD_ERROR, FIELD_ERROR_MESSAGE
+} JsonField;
+
+static void response_init(CurlResponse *resp, CURL *curl) {
+    memset(resp, 0, sizeof(*resp));
+    resp->curl = curl;
+    resp->text = resp->language = resp->error_message = -1;
+    resp->string_start = -1;
+}
+
+static void response_free(CurlResponse *resp) {
+    free(resp->arena);
+    free(resp->segments);
+    response_init(resp, NULL);
+}
+
+static int arena_reserve(CurlResponse *resp, size_t extra) {
+    if (resp->arena_len + extra <= resp->arena_cap) return 0;
+    size_t cap = resp->arena_cap ? resp->arena_cap * 2 : 1024;
+    while (cap < resp->arena_len + extra) cap *= 2;
+    char *arena = realloc(resp->arena, cap);
+    if (!arena) return -1;
+    resp->arena = arena;
+    resp->arena_cap = cap;
+    return 0;
+}
+
+static void arena_put(CurlResponse *resp, const char *bytes, size_t n) {
+    if (resp->string_start < 0) return;
+    if (arena_reserve(resp, n) != 0) {
+        resp->failed = 1;
+        return;
+    }
+    memcpy(resp->arena + resp->arena_len, bytes, n);
+    resp->arena_len += n;
+}
+
+static void arena_put_codepoint(CurlResponse *resp, uint32_t cp) {
+    char utf8[4];
+    size_t n;
+    if (cp < 0x80) {
+        utf8[0] = cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = 0xC0 | (cp >> 6);
+        utf8[1] = 0x80 | (cp & 0x3F);
+        n = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = 0xE0 | (cp >> 12);
+        utf8[1] = 0x80 | ((cp >> 6) & 0x3F);
+        utf8[2] = 0x80 | (cp & 0x3F);
+        n = 3;
+    } else {
+        utf8[0] = 0xF0 | (cp >> 18);
+        utf8[1] = 0x80 | ((cp >> 12) & 0x3F);
+        utf8[2] = 0x80 | ((cp >> 6) & 0x3F);
+        utf8[3] = 0x80 | (cp & 0x3F);
+        n = 4;
+    }
+    arena_put(resp, utf8, n);
+}
+
+// A high surrogate not followed by its low half becomes U+FFFD
+static void flush_surrogate(CurlResponse *resp) {
+    if (!resp->high_surrogate) return;
+    arena_put_codepoint(resp, 0xFFFD);
+    resp->high_surrogate = 0;
+}
+
+// What a value under the current container and key is for
+static int json_field_for_key(CurlResponse *resp) {
+    int ctx = resp->ctx[resp->depth - 1];
+    const char *key = resp->key_len < sizeof(resp->key) ? resp->key : "";
+    if (ctx == FIELD_ROOT) {
+        if (strcmp(key, "text") == 0) return FIELD_TEXT;
+        if (strcmp(key, "language") == 0) return FIELD_LANGUAGE;
+        if (strcmp(key, "duration") == 0) return FIELD_DURATION;
+        if (strcmp(key, "segments") == 0) return FIELD_SEGMENTS;
+        if (strcmp(key, "error") == 0) return FIELD_ERROR;
+    } else if (ctx == FIELD_SEGMENT) {
+        if (strcmp(key, "start") == 0) return FIELD_SEGMENT_START;
+        if (strcmp(key, "end") == 0) return FIELD_SEGMENT_END;
+        if (strcmp(key, "text") == 0) return FIELD_SEGMENT_TEXT;
+    } else if (ctx == FIELD_ERROR) {
+        if (strcmp(key, "message") == 0) return FIELD_ERROR_MESSAGE;
+    }
+    return FIELD_NONE;
+}
+
+static int json_is_string_field(int field) {
+    return field == FIELD_TEXT || field == FIELD_LANGUAGE || field == FIELD_SEGMENT_TEXT ||
+           field == FIELD_ERROR_MESSAGE;
+}
+
+static ResponseSegment *current_segment(CurlResponse *resp) {
+    return resp->segment_count ? &resp->segments[resp->segment_count - 1] : NULL;
+}
+
+static void json_open(CurlResponse *resp, unsigned char kind) {
+    if (resp->depth == JSON_MAX_DEPTH) {
+        resp->failed = 1;
+        return;
+    }
+    int ctx = FIELD_NONE;
+    if (kind == '{' && resp->depth == 0) ctx = FIELD_ROOT;
+    else if (kind == '{' && (resp->field == FIELD_SEGMENT || resp->field == FIELD_ERROR)) ctx = resp->field;
+    else if (kind == '[' && resp->field == FIELD_SEGMENTS) ctx = FIELD_SEGMENTS;
+
+    if (ctx == FIELD_SEGMENT) {
+        if (resp->segment_count == resp->segment_cap) {
+            size_t cap = resp->segment_cap ? resp->segment_cap * 2 : 16;
+            ResponseSegment *segments = realloc(resp->segments, cap * sizeof(ResponseSegment));
+            if (!segments) {
+                resp->failed = 1;
+                return;
+            }
+            resp->segments = segments;
+            resp->segment_cap = cap;
+        }
+        resp->segments[resp->segment_count++] = (ResponseSegment){ 0.0, 0.0, (size_t)-1 };
+    }
+    resp->stack[resp->depth] = kind;
+    resp->ctx[resp->depth] = ctx;
+    resp->depth++;
+}
+
+static void json_close_string(CurlResponse *resp) {
+    flush_surrogate(resp);
+    if (resp->string_start < 0) return;
+    arena_put(resp, "", 1);
+    long start = resp->string_start;
+    resp->string_start = -1;
+    if (resp->failed) return;
+    if (resp->field == FIELD_TEXT) resp->text = start;
+    else if (resp->field == FIELD_LANGUAGE) resp->language = start;
+    else if (resp->field == FIELD_ERROR_MESSAGE) resp->error_message = start;
+    else if (resp->field == FIELD_SEGMENT_TEXT && current_segment(resp)) current_segment(resp)->text = start;
+}
+
+static void json_close_number(CurlResponse *resp) {
+    resp->num[resp->num_len < sizeof(resp->num) ? resp->num_len : sizeof(resp->num) - 1] = '\0';
+    double v = strtod(resp->num, NULL);
+    if (resp->field == FIELD_DURATION) resp->duration = v;
+    else if (resp->field == FIELD_SEGMENT_START && current_segment(resp)) current_segment(resp)->start = v;
+    else if (resp->field == FIELD_SEGMENT_END && current_segment(resp)) current_segment(resp)->end = v;
+}
+
+static void json_feed(CurlResponse *resp, const char *data, size_t len) {
+    for (size_t i = 0; i < len && !resp->failed; i++) {
+        unsigned char c = data[i];
+        int ws = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+
+        switch (resp->state) {
+        case JSON_VALUE_OR_END:
+            if (ws) break;
+            if (c == ']') {
+                resp->depth--;
+                resp->state = JSON_AFTER_VALUE;
+                break;
+            }
+            resp->field = resp->ctx[resp->depth - 1] == FIELD_SEGMENTS ? FIELD_SEGMENT : FIELD_NONE;
+            // fall through
+        case JSON_VALUE:
+            if (ws) break;
+            if (c == '{') {
+                json_open(resp, '{');
+                resp->state = JSON_KEY_OR_END;
+            } else if (c == '[') {
+                json_open(resp, '[');
+                resp->state = JSON_VALUE_OR_END;
+            } else if (c == '"') {
+                resp->string_start = json_is_string_field(resp->field) && arena_reserve(resp, 0) == 0
+                                         ? (int)resp->arena_len : -1;
+                resp->state = JSON_STRING;
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                resp->num[0] = c;
+                resp->num_len = 1;
+                resp->state = JSON_NUMBER;
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                resp->state = JSON_LITERAL;
+            } else {
+                resp->failed = 1;
+            }
+            break;
+        case JSON_KEY_OR_END:
+            if (ws) break;
+            if (c == '}') {
+                resp->depth--;
+                resp->state = JSON_AFTER_VALUE;
+                break;
+            }
+            // fall through
+        case JSON_KEY_START:
+            if (ws) break;
+            if (c != '"') {
+                resp->failed = 1;
+                break;
+            }
+            resp->key_len = 0;
+            resp->state = JSON_KEY;
+            break;
+        case JSON_KEY:
+            if (c == '"') {
+                if (resp->key_len < sizeof(resp->key)) resp->key[resp->key_len] = '\0';
+                resp->state = JSON_COLON;
+            } else {
+                // Keys we look for are short ASCII; escapes inside keys just never match
+                if (c == '\\') resp->state = JSON_KEY_ESCAPE;
+                if (resp->key_len < sizeof(resp->key)) resp->key[resp->key_len] = c;
+                resp->key_len++;
+            }
+            break;
+        case JSON_KEY_ESCAPE:
+            resp->state = JSON_KEY;
+            break;
+        case JSON_COLON:
+            if (ws) break;
+            if (c != ':') {
+                resp->failed = 1;
+                break;
+            }
+            resp->field = json_field_for_key(resp);
+            resp->state = JSON_VALUE;
+            break;
+        case JSON_STRING:
+            if (c == '"') {
+                json_close_string(resp);
+                resp->state = JSON_AFTER_VALUE;
+            } else if (c == '\\') {
+                resp->state = JSON_ESCAPE;
+            } else {
+                flush_surrogate(resp);
+                // Copy the run of plain bytes in one go
+                size_t run = 1;
+                while (i + run < len && data[i + run] != '"' && data[i + run] != '\\') run++;
+                arena_put(resp, data + i, run);
+                i += run - 1;
+            }
+            break;
+        case JSON_ESCAPE: {
+            if (c == 'u') {
+                resp->hex = 0;
+                resp->hex_digits = 0;
+                resp->state = JSON_UNICODE;
+                break;
+            }
+            flush_surrogate(resp);
+            char out = c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == 'b' ? '\b' : c == 'f' ? '\f' : c;
+            arena_put(resp, &out, 1);
+            resp->state = JSON_STRING;
+            break;
+        }
+        case JSON_UNICODE: {
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                      : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                resp->failed = 1;
+                break;
+            }
+            resp->hex = resp->hex << 4 | digit;
+            if (++resp->hex_digits < 4) break;
+
+            uint32_t cp = resp->hex;
+            if (cp >= 0xDC00 && cp <= 0xDFFF && resp->high_surrogate) {
+                cp = 0x10000 + ((resp->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+                resp->high_surrogate = 0;
+                arena_put_codepoint(resp, cp);
+            } else {
+                flush_surrogate(resp);
+                if (cp >= 0xD800 && cp <= 0xDBFF) resp->high_surrogate = cp;
+                else arena_put_codepoint(resp, cp >= 0xDC00 && cp <= 0xDFFF ? 0xFFFD : cp);
+            }
+            resp->state = JSON_STRING;
+            break;
+        }
+        case JSON_NUMBER:
+            if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                if (resp->num_len < sizeof(resp->num) - 1) resp->num[resp->num_len] = c;
+                resp->num_len++;
+                break;
+            }
+            json_close_number(resp);
+            resp->state = JSON_AFTER_VALUE;
+            i--; // this byte belongs to whatever follows the number
+            break;
+        case JSON_LITERAL:
+            if (c >= 'a' && c <= 'z') break;
+            resp->state = JSON_AFTER_VALUE;
+            i--;
+            break;
+        case JSON_AFTER_VALUE:
+            if (ws) break;
+            if (resp->depth == 0) {
+                resp->failed = 1; // trailing garbage
+            } else if (c == ',') {
+                if (resp->stack[resp->depth - 1] == '{') {
+                    resp->state = JSON_KEY_START;
+                } else {
+                    resp->field = resp->ctx[resp->depth - 1] == FIELD_SEGMENTS ? FIELD_SEGMENT : FIELD_NONE;
+                    resp->state = JSON_VALUE;
+                }
+            } else if (c == (resp->stack[resp->depth - 1] == '{' ? '}' : ']')) {
+                resp->depth--;
+            } else {
+                resp->failed = 1;
+            }
+            if (resp->depth == 0 && !resp->failed) resp->state = JSON_DONE;
+            break;
+        case JSON_DONE:
+            if (!ws) resp->failed = 1;
+            break;
+        }
+    }
+}
 
-// CURL callback
+// CURL callback: parse the body as it arrives
 static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
     CurlResponse *resp = (CurlResponse *)userp;
 
-    char *ptr = realloc(resp->data, resp->size + realsize + 1);
-    if (!ptr) return 0;
-
-    resp->data = ptr;
-    memcpy(&(resp->data[resp->size]), contents, realsize);
-    resp->size += realsize;
-    resp->data[resp->size] = 0;
-
+    // Decoded strings are never longer than the body, so one allocation usually suffices
+    if (!resp->arena && resp->curl) {
+        curl_off_t length = -1;
+        if (curl_easy_getinfo(resp->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK &&
+            length > 0 && length < 64 * 1024 * 1024) {
+            arena_reserve(resp, (size_t)length + 1);
+        }
+    }
+    json_feed(resp, contents, realsize);
     return realsize;
 }
 
+// The transcript of a completely parsed response, as a new string
+static int response_text(const CurlResponse *resp, char **result) {
+    if (resp->failed || resp->state != JSON_DONE || resp->text < 0) return -1;
+    *result = strdup(resp->arena + resp->text);
+    return *result ? 0 : -1;
+}
+
 // Audio buffer functions
 static void init_audio_buffer(AudioBuffer *buf, size_t initial_size) {
     buf->data = malloc(initial_size);
@@ -68,6 +941,7 @@ static void init_audio_buffer(AudioBuffer *buf, size_t initial_size) {
     buf->capacity = initial_size;
 }
 
+#if defined(HAVE_FLAC) || defined(HAVE_OPUS)
 static void append_audio_buffer(AudioBuffer *buf, const void *data, size_t size) {
     if (buf->size + size > buf->capacity) {
         size_t new_capacity = buf->capacity * 2;
@@ -82,6 +956,7 @@ static void append_audio_buffer(AudioBuffer *buf, const void *data, size_t size)
     memcpy((char*)buf->data + buf->size, data, size);
     buf->size += size;
 }
+#endif
 
 static void free_audio_buffer(AudioBuffer *buf) {
     free(buf->data);
@@ -90,450 +965,4045 @@ static void free_audio_buffer(AudioBuffer *buf) {
     buf->capacity = 0;
 }
 
-// Update status file
-static void update_status(const char *status, float level) {
-    if (g_status_file) {
-        fseek(g_status_file, 0, SEEK_SET);
-        time_t elapsed = time(NULL) - g_record_start_time;
-        fprintf(g_status_file, "%s|%.2f|%02ld:%02ld\n", status, level, elapsed / 60, elapsed % 60);
-        ftruncate(fileno(g_status_file), ftell(g_status_file)); // Truncate any leftover content
-        fflush(g_status_file);
+// Size the block table for max_bytes and allocate the first block up front
+static int audio_store_init(AudioStore *st, size_t max_bytes) {
+    memset(st, 0, sizeof(*st));
+    size_t max_blocks = max_bytes / AUDIO_BLOCK_BYTES + 1;
+    st->blocks = calloc(max_blocks, sizeof(char *));
+    if (st->blocks && (st->blocks[0] = malloc(AUDIO_BLOCK_BYTES))) {
+        st->max_blocks = max_blocks;
+        return 0;
     }
+    free(st->blocks); // max_blocks stays 0, so appends are refused
+    st->blocks = NULL;
+    return -1;
 }
 
-// Monitor thread - creates a visual indicator using waybar or similar
-static void *monitor_thread(void *arg) {
-    // Create a simple working Python visualization script
-    const char *viz_script =
-        "#!/usr/bin/env python3\n"
-        "import gi\n"
-        "gi.require_version('Gtk', '3.0')\n"
-        "from gi.repository import Gtk, Gdk, GLib\n"
-        "import cairo\n"
-        "import math, time, os\n"
-        "\n"
-        "class AudioVisualizer(Gtk.Window):\n"
-        "    def __init__(self):\n"
-        "        super().__init__()\n"
-        "        self.set_title('Recording')\n"
-        "        self.set_type_hint(Gdk.WindowTypeHint.NOTIFICATION)\n"
-        "        self.set_default_size(400, 100)\n"
-        "        self.set_decorated(False)\n"
-        "        self.set_keep_above(True)\n"
-        "        self.set_app_paintable(True)\n"
-        "        screen = self.get_screen()\n"
-        "        visual = screen.get_rgba_visual()\n"
-        "        if visual: self.set_visual(visual)\n"
-        "        \n"
-        "        # Center on screen\n"
-        "        self.set_position(Gtk.WindowPosition.CENTER)\n"
-        "        self.stick()  # Show on all workspaces\n"
-        "        self.set_skip_taskbar_hint(True)\n"
-        "        self.set_skip_pager_hint(True)\n"
-        "        \n"
-        "        # Make click-through and non-focusable\n"
-        "        self.set_events(0)\n"
-        "        self.input_shape_combine_region(None)\n"
-        "        self.set_accept_focus(False)\n"
-        "        self.set_can_focus(False)\n"
-        "        \n"
-        "        self.drawing_area = Gtk.DrawingArea()\n"
-        "        self.drawing_area.connect('draw', self.on_draw)\n"
-        "        self.add(self.drawing_area)\n"
-        "        \n"
-        "        self.level = 0.0\n"
-        "        self.time_str = '00:00'\n"
-        "        self.status = 'RECORDING'\n"
-        "        self.history = [0.0] * 60\n"
-        "        \n"
-        "        GLib.timeout_add(50, self.update_display)\n"
-        "        self.show_all()\n"
-        "    \n"
-        "    def update_display(self):\n"
-        "        try:\n"
-        "            with open('/tmp/voice_transcribe.status', 'r') as f:\n"
-        "                line = f.readline().strip()\n"
-        "                if line:\n"
-        "                    parts = line.split('|')\n"
-        "                    self.status = parts[0]\n"
-        "                    \n"
-        "                    if self.status in ['COPIED', 'FAILED', 'NO_AUDIO']:\n"
-        "                        if self.status == 'COPIED':\n"
-        "                            GLib.timeout_add(1000, Gtk.main_quit)\n"
-        "                        else:\n"
-        "                            GLib.timeout_add(2000, Gtk.main_quit)\n"
-        "                        return False\n"
-        "                    \n"
-        "                    if len(parts) > 1:\n"
-        "                        self.level = float(parts[1])\n"
-        "                    if len(parts) > 2:\n"
-        "                        self.time_str = parts[2]\n"
-        "                    \n"
-        "                    self.history.append(self.level)\n"
-        "                    self.history.pop(0)\n"
-        "        except: pass\n"
-        "        \n"
-        "        self.drawing_area.queue_draw()\n"
-        "        return True\n"
-        "    \n"
-        "    def on_draw(self, widget, cr):\n"
-        "        width = widget.get_allocated_width()\n"
-        "        height = widget.get_allocated_height()\n"
-        "        \n"
-        "        # Clear background properly\n"
-        "        cr.set_operator(cairo.OPERATOR_SOURCE)\n"
-        "        cr.set_source_rgba(0.1, 0.1, 0.2, 0.95)\n"
-        "        cr.paint()\n"
-        "        cr.set_operator(cairo.OPERATOR_OVER)\n"
-        "        \n"
-        "        # Draw border\n"
-        "        cr.set_line_width(1)\n"
-        "        cr.set_source_rgba(0.3, 0.3, 0.5, 0.5)\n"
-        "        cr.rectangle(0.5, 0.5, width-1, height-1)\n"
-        "        cr.stroke()\n"
-        "        \n"
-        "        # Draw waveform bars\n"
-        "        bar_width = width / len(self.history)\n"
-        "        for i, level in enumerate(self.history):\n"
-        "            x = i * bar_width\n"
-        "            bar_height = height * level * 0.7\n"
-        "            y = (height - bar_height) / 2\n"
-        "            \n"
-        "            # Gradient based on level\n"
-        "            bar_gradient = cairo.LinearGradient(x, y, x, y + bar_height)\n"
-        "            if level > 0.7:\n"
-        "                bar_gradient.add_color_stop_rgba(0, 1.0, 0.3, 0.3, 0.9)\n"
-        "                bar_gradient.add_color_stop_rgba(1, 0.8, 0.1, 0.1, 0.7)\n"
-        "            elif level > 0.4:\n"
-        "                bar_gradient.add_color_stop_rgba(0, 0.9, 0.3, 1.0, 0.9)\n"
-        "                bar_gradient.add_color_stop_rgba(1, 0.6, 0.1, 0.8, 0.7)\n"
-        "            else:\n"
-        "                bar_gradient.add_color_stop_rgba(0, 0.3, 0.7, 1.0, 0.9)\n"
-        "                bar_gradient.add_color_stop_rgba(1, 0.1, 0.4, 0.8, 0.7)\n"
-        "            \n"
-        "            cr.set_source(bar_gradient)\n"
-        "            cr.rectangle(x + 1, y, bar_width - 2, bar_height)\n"
-        "            cr.fill()\n"
-        "        \n"
-        "        # Draw status text with background\n"
-        "        cr.select_font_face('Sans')\n"
-        "        \n"
-        "        # Status message in center-bottom\n"
-        "        status_text = {\n"
-        "            'CONNECTING': 'Connecting to microphone...',\n"
-        "            'READY': 'Microphone ready',\n"
-        "            'RECORDING': 'Recording...',\n"
-        "            'PROCESSING': 'Processing...',\n"
-        "            'UPLOADING': 'Uploading to OpenAI...',\n"
-        "            'COPIED': 'Copied to clipboard!',\n"
-        "            'FAILED': 'Transcription failed',\n"
-        "            'NO_AUDIO': 'No audio recorded',\n"
-        "            'MAX_TIME': 'Max time reached',\n"
-        "            'ERROR': 'Error occurred'\n"
-        "        }.get(self.status, self.status)\n"
-        "        \n"
-        "        cr.set_font_size(13)\n"
-        "        text_extents = cr.text_extents(status_text)\n"
-        "        text_x = (width - text_extents.width) / 2\n"
-        "        text_y = height - 10\n"
-        "        \n"
-        "        # Text background\n"
-        "        cr.set_source_rgba(0.0, 0.0, 0.0, 0.6)\n"
-        "        cr.rectangle(text_x - 5, text_y - text_extents.height - 2, text_extents.width + 10, text_extents.height + 4)\n"
-        "        cr.fill()\n"
-        "        \n"
-        "        # Status text\n"
-        "        if self.status == 'COPIED':\n"
-        "            cr.set_source_rgba(0.0, 1.0, 0.5, 1.0)\n"
-        "        elif self.status in ['FAILED', 'ERROR']:\n"
-        "            cr.set_source_rgba(1.0, 0.3, 0.3, 1.0)\n"
-        "        elif self.status in ['UPLOADING', 'PROCESSING']:\n"
-        "            cr.set_source_rgba(1.0, 0.8, 0.2, 1.0)\n"
-        "        else:\n"
-        "            cr.set_source_rgba(1.0, 1.0, 1.0, 0.9)\n"
-        "        cr.move_to(text_x, text_y)\n"
-        "        cr.show_text(status_text)\n"
-        "        \n"
-        "        # Time in top-right\n"
-        "        if self.status == 'RECORDING':\n"
-        "            cr.set_font_size(11)\n"
-        "            cr.set_source_rgba(0.8, 0.8, 0.8, 0.7)\n"
-        "            cr.move_to(width - 45, 15)\n"
-        "            cr.show_text(self.time_str)\n"
-        "            \n"
-        "            # Recording dot animation\n"
-        "            cr.set_source_rgba(1.0, 0.0, 0.0, 0.5 + 0.5 * math.sin(time.time() * 5))\n"
-        "            cr.arc(15, 15, 4, 0, 2 * math.pi)\n"
-        "            cr.fill()\n"
+static int audio_store_append(AudioStore *st, const void *data, size_t size) {
+    const char *src = data;
+    while (size > 0) {
+        size_t index = st->size / AUDIO_BLOCK_BYTES;
+        size_t used = st->size % AUDIO_BLOCK_BYTES;
+        if (index >= st->max_blocks || (!st->blocks[index] && !(st->blocks[index] = malloc(AUDIO_BLOCK_BYTES)))) {
+            if (!st->overflow) fprintf(stderr, "Recording store full, dropping audio\n");
+            st->overflow = 1;
+            return -1;
+        }
+        size_t n = AUDIO_BLOCK_BYTES - used;
+        if (n > size) n = size;
+        memcpy(st->blocks[index] + used, src, n);
+        st->size += n;
+        src += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Contiguous bytes at offset, up to the end of their block; *len gets the count
+static const char *audio_store_span(const AudioStore *st, size_t offset, size_t limit, size_t *len) {
+    size_t n = AUDIO_BLOCK_BYTES - offset % AUDIO_BLOCK_BYTES;
+    if (n > limit - offset) n = limit - offset;
+    *len = n;
+    return st->blocks[offset / AUDIO_BLOCK_BYTES] + offset % AUDIO_BLOCK_BYTES;
+}
+
+static void audio_store_copy(const AudioStore *st, size_t offset, void *dest, size_t size) {
+    char *out = dest;
+    size_t end = offset + size;
+    while (offset < end) {
+        size_t n;
+        const char *src = audio_store_span(st, offset, end, &n);
+        memcpy(out, src, n);
+        out += n;
+        offset += n;
+    }
+}
+
+// Run a range of the store through an encoder, one block-sized span at a time
+static int audio_store_encode(Encoder *enc, const AudioStore *st, size_t offset, size_t size) {
+    size_t end = offset + size;
+    while (offset < end) {
+        size_t n;
+        const char *span = audio_store_span(st, offset, end, &n);
+        if (enc->type->encode(enc, (const short *)span, n / sizeof(short)) != 0) return -1;
+        offset += n;
+    }
+    return 0;
+}
+
+static void audio_store_free(AudioStore *st) {
+    for (size_t i = 0; st->blocks && i < st->max_blocks; i++) free(st->blocks[i]);
+    free(st->blocks);
+    memset(st, 0, sizeof(*st));
+}
+
+// DSP kernels: scalar reference versions first, then SIMD variants of the same
+static int peak_scalar(const short *x, size_t n) {
+    int hi = 0, lo = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] > hi) hi = x[i];
+        if (x[i] < lo) lo = x[i];
+    }
+    return hi > -lo ? hi : -lo;
+}
+
+static uint64_t sum_squares_scalar(const short *x, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += (int32_t)x[i] * x[i];
+    return sum;
+}
+
+static void to_float_scalar(const short *x, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = x[i] * (1.0f / 32768.0f);
+}
+
+static void gain_scalar(short *x, size_t n, int gain_q12) {
+    for (size_t i = 0; i < n; i++) {
+        int v = (x[i] * gain_q12) >> 12;
+        x[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+    }
+}
+
+static float dot_scalar(const float *x, const float *h, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) sum += x[i] * h[i];
+    return sum;
+}
+
+static const DspKernels g_dsp_scalar = { "scalar", peak_scalar, sum_squares_scalar, to_float_scalar, gain_scalar,
+                                         dot_scalar };
+
+#if defined(__x86_64__)
+static int peak_sse2(const short *x, size_t n) {
+    __m128i hi = _mm_setzero_si128(), lo = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        hi = _mm_max_epi16(hi, v);
+        lo = _mm_min_epi16(lo, v);
+    }
+    short h[8], l[8];
+    _mm_storeu_si128((__m128i *)h, hi);
+    _mm_storeu_si128((__m128i *)l, lo);
+    int peak = peak_scalar(x + i, n - i);
+    for (int k = 0; k < 8; k++) {
+        if (h[k] > peak) peak = h[k];
+        if (-l[k] > peak) peak = -l[k];
+    }
+    return peak;
+}
+
+static uint64_t sum_squares_sse2(const short *x, size_t n) {
+    __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i sq = _mm_madd_epi16(v, v); // pairs of squares; up to 2^31, so widen as unsigned
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return lanes[0] + lanes[1] + sum_squares_scalar(x + i, n - i);
+}
+
+static void to_float_sse2(const short *x, float *out, size_t n) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    to_float_scalar(x + i, out + i, n - i);
+}
+
+static void gain_sse2(short *x, size_t n, int gain_q12) {
+    const __m128i g = _mm_set1_epi16(gain_q12);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+        __m128i lo16 = _mm_mullo_epi16(v, g), hi16 = _mm_mulhi_epi16(v, g);
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(lo16, hi16), 12);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(lo16, hi16), 12);
+        _mm_storeu_si128((__m128i *)(x + i), _mm_packs_epi32(lo, hi));
+    }
+    gain_scalar(x + i, n - i, gain_q12);
+}
+
+static float dot_sse2(const float *x, const float *h, size_t n) {
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(x + i, h + i, n - i);
+}
+
+static const DspKernels g_dsp_sse2 = { "sse2", peak_sse2, sum_squares_sse2, to_float_sse2, gain_sse2, dot_sse2 };
+
+__attribute__((target("avx2")))
+static int peak_avx2(const short *x, size_t n) {
+    __m256i hi = _mm256_setzero_si256(), lo = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        hi = _mm256_max_epi16(hi, v);
+        lo = _mm256_min_epi16(lo, v);
+    }
+    short h[16], l[16];
+    _mm256_storeu_si256((__m256i *)h, hi);
+    _mm256_storeu_si256((__m256i *)l, lo);
+    int peak = peak_sse2(x + i, n - i);
+    for (int k = 0; k < 16; k++) {
+        if (h[k] > peak) peak = h[k];
+        if (-l[k] > peak) peak = -l[k];
+    }
+    return peak;
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_squares_avx2(const short *x, size_t n) {
+    __m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i sq = _mm256_madd_epi16(v, v);
+        acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+        acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_squares_sse2(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void to_float_avx2(const short *x, float *out, size_t n) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(x + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    to_float_scalar(x + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void gain_avx2(short *x, size_t n, int gain_q12) {
+    const __m256i g = _mm256_set1_epi16(gain_q12);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+        __m256i lo16 = _mm256_mullo_epi16(v, g), hi16 = _mm256_mulhi_epi16(v, g);
+        // unpack and pack both work per 128-bit lane, so sample order is preserved
+        __m256i lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(lo16, hi16), 12);
+        __m256i hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(lo16, hi16), 12);
+        _mm256_storeu_si256((__m256i *)(x + i), _mm256_packs_epi32(lo, hi));
+    }
+    gain_scalar(x + i, n - i, gain_q12);
+}
+
+__attribute__((target("avx2")))
+static float dot_avx2(const float *x, const float *h, size_t n) {
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i)));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_sse2(x + i, h + i, n - i);
+}
+
+static const DspKernels g_dsp_avx2 = { "avx2", peak_avx2, sum_squares_avx2, to_float_avx2, gain_avx2, dot_avx2 };
+#endif
+
+#if defined(__aarch64__)
+static int peak_neon(const short *x, size_t n) {
+    int16x8_t hi = vdupq_n_s16(0), lo = vdupq_n_s16(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        hi = vmaxq_s16(hi, v);
+        lo = vminq_s16(lo, v);
+    }
+    int peak = peak_scalar(x + i, n - i);
+    int h = vmaxvq_s16(hi), l = -(int)vminvq_s16(lo);
+    if (h > peak) peak = h;
+    if (l > peak) peak = l;
+    return peak;
+}
+
+static uint64_t sum_squares_neon(const short *x, size_t n) {
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        uint32x4_t lo = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v)));
+        uint32x4_t hi = vreinterpretq_u32_s32(vmull_high_s16(v, v));
+        acc = vpadalq_u32(acc, lo);
+        acc = vpadalq_u32(acc, hi);
+    }
+    return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + sum_squares_scalar(x + i, n - i);
+}
+
+static void to_float_neon(const short *x, float *out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(v)), 1.0f / 32768.0f));
+    }
+    to_float_scalar(x + i, out + i, n - i);
+}
+
+static void gain_neon(short *x, size_t n, int gain_q12) {
+    const int16x4_t g = vdup_n_s16(gain_q12);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        int32x4_t lo = vmull_s16(vget_low_s16(v), g);
+        int32x4_t hi = vmull_s16(vget_high_s16(v), g);
+        vst1q_s16(x + i, vcombine_s16(vqshrn_n_s32(lo, 12), vqshrn_n_s32(hi, 12)));
+    }
+    gain_scalar(x + i, n - i, gain_q12);
+}
+
+static float dot_neon(const float *x, const float *h, size_t n) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) acc = vfmaq_f32(acc, vld1q_f32(x + i), vld1q_f32(h + i));
+    return vaddvq_f32(acc) + dot_scalar(x + i, h + i, n - i);
+}
+
+static const DspKernels g_dsp_neon = { "neon", peak_neon, sum_squares_neon, to_float_neon, gain_neon, dot_neon };
+#endif
+
+// Pick the widest kernels this CPU runs; name forces a specific set ("scalar", ...)
+static void dsp_init(const char *name) {
+    static const DspKernels *available[] = {
+#if defined(__x86_64__)
+        &g_dsp_avx2, &g_dsp_sse2,
+#elif defined(__aarch64__)
+        &g_dsp_neon,
+#endif
+        &g_dsp_scalar,
+    };
+
+    g_dsp = &g_dsp_scalar;
+    for (size_t i = 0; i < sizeof(available) / sizeof(available[0]); i++) {
+#if defined(__x86_64__)
+        if (available[i] == &g_dsp_avx2 && !__builtin_cpu_supports("avx2")) continue;
+#endif
+        if (!name || strcmp(name, available[i]->name) == 0) {
+            g_dsp = available[i];
+            break;
+        }
+    }
+}
+
+// Fill a 16-bit PCM WAV header; pass WAV_STREAMING_SIZE when the length is not known yet
+static void fill_wav_header(WavHeader *h, uint32_t data_size) {
+    memcpy(h->riff, "RIFF", 4);
+    h->size = data_size == WAV_STREAMING_SIZE ? WAV_STREAMING_SIZE : 36 + data_size;
+    memcpy(h->wave, "WAVE", 4);
+    memcpy(h->fmt, "fmt ", 4);
+    h->fmt_size = 16;
+    h->format = 1;
+    h->channels = CHANNELS;
+    h->sample_rate = SAMPLE_RATE;
+    h->byte_rate = SAMPLE_RATE * CHANNELS * 2;
+    h->block_align = CHANNELS * 2;
+    h->bits_per_sample = 16;
+    memcpy(h->data, "data", 4);
+    h->data_size = data_size;
+}
+
+// Encoders
+#ifdef HAVE_FLAC
+static FLAC__StreamEncoderWriteStatus flac_write_callback(const FLAC__StreamEncoder *e, const FLAC__byte buffer[],
+                                                          size_t bytes, uint32_t samples, uint32_t frame,
+                                                          void *client_data) {
+    (void)e;
+    (void)samples;
+    (void)frame;
+    Encoder *enc = (Encoder *)client_data;
+    size_t before = enc->out.size;
+    append_audio_buffer(&enc->out, buffer, bytes);
+    return enc->out.size == before + bytes ? FLAC__STREAM_ENCODER_WRITE_STATUS_OK
+                                           : FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+}
+
+static int flac_init(Encoder *enc) {
+    FLAC__StreamEncoder *e = FLAC__stream_encoder_new();
+    if (!e) return -1;
+    FLAC__stream_encoder_set_channels(e, CHANNELS);
+    FLAC__stream_encoder_set_bits_per_sample(e, 16);
+    FLAC__stream_encoder_set_sample_rate(e, SAMPLE_RATE);
+    FLAC__stream_encoder_set_compression_level(e, 5);
+    // No seek callback: the stream is written front to back so it can be uploaded as it grows
+    if (FLAC__stream_encoder_init_stream(e, flac_write_callback, NULL, NULL, NULL, enc) !=
+        FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        FLAC__stream_encoder_delete(e);
+        return -1;
+    }
+    enc->codec = e;
+    return 0;
+}
+
+static int flac_encode(Encoder *enc, const short *pcm, size_t frames) {
+    FLAC__int32 samples[BUFFER_SIZE];
+    while (frames > 0) {
+        size_t n = frames < BUFFER_SIZE ? frames : BUFFER_SIZE;
+        for (size_t i = 0; i < n; i++) samples[i] = pcm[i];
+        if (!FLAC__stream_encoder_process_interleaved(enc->codec, samples, n)) return -1;
+        pcm += n;
+        frames -= n;
+    }
+    return 0;
+}
+
+static int flac_finish(Encoder *enc) {
+    return FLAC__stream_encoder_finish(enc->codec) ? 0 : -1;
+}
+
+static void flac_destroy(Encoder *enc) {
+    if (enc->codec) FLAC__stream_encoder_delete(enc->codec);
+}
+#endif
+
+#ifdef HAVE_OPUS
+static int opus_write_callback(void *user_data, const unsigned char *ptr, opus_int32 len) {
+    Encoder *enc = (Encoder *)user_data;
+    size_t before = enc->out.size;
+    append_audio_buffer(&enc->out, ptr, len);
+    return enc->out.size == before + (size_t)len ? 0 : 1;
+}
+
+static int opus_close_callback(void *user_data) {
+    (void)user_data;
+    return 0;
+}
+
+static int opus_init(Encoder *enc) {
+    static const OpusEncCallbacks callbacks = { opus_write_callback, opus_close_callback };
+    int err;
+
+    enc->comments = ope_comments_create();
+    if (!enc->comments) return -1;
+    OggOpusEnc *e = ope_encoder_create_callbacks(&callbacks, enc, enc->comments, SAMPLE_RATE, CHANNELS, 0, &err);
+    if (!e) return -1;
+    ope_encoder_ctl(e, OPUS_SET_BITRATE(g_opus_bitrate));
+    ope_encoder_ctl(e, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    ope_encoder_ctl(e, OPE_SET_MUXING_DELAY(24000)); // flush pages every 0.5 s for streaming
+    enc->codec = e;
+    return 0;
+}
+
+static int opus_encode(Encoder *enc, const short *pcm, size_t frames) {
+    return ope_encoder_write(enc->codec, pcm, frames) == OPE_OK ? 0 : -1;
+}
+
+static int opus_finish(Encoder *enc) {
+    return ope_encoder_drain(enc->codec) == OPE_OK ? 0 : -1;
+}
+
+static void opus_destroy(Encoder *enc) {
+    if (enc->codec) ope_encoder_destroy(enc->codec);
+    if (enc->comments) ope_comments_destroy(enc->comments);
+}
+#endif
+
+static const EncoderType g_encoder_types[] = {
+    { "wav", "audio.wav", "audio/wav", NULL, NULL, NULL, NULL },
+#ifdef HAVE_FLAC
+    { "flac", "audio.flac", "audio/flac", flac_init, flac_encode, flac_finish, flac_destroy },
+#endif
+#ifdef HAVE_OPUS
+    { "opus", "audio.ogg", "audio/ogg", opus_init, opus_encode, opus_finish, opus_destroy },
+#endif
+};
+
+static const EncoderType *find_encoder_type(const char *name) {
+    for (size_t i = 0; i < sizeof(g_encoder_types) / sizeof(g_encoder_types[0]); i++) {
+        if (strcmp(g_encoder_types[i].name, name) == 0) return &g_encoder_types[i];
+    }
+    return NULL;
+}
+
+static void encoder_free(Encoder *enc) {
+    if (!enc) return;
+    enc->type->destroy(enc);
+    free_audio_buffer(&enc->out);
+    free(enc);
+}
+
+// Returns NULL for WAV (nothing to encode) or if the codec fails to start
+static Encoder *encoder_new(const EncoderType *type) {
+    if (!type || !type->init) return NULL;
+    Encoder *enc = calloc(1, sizeof(Encoder));
+    if (!enc) return NULL;
+    enc->type = type;
+    init_audio_buffer(&enc->out, 64 * 1024);
+    if (type->init(enc) < 0) {
+        fprintf(stderr, "Cannot start %s encoder, uploading WAV\n", type->name);
+        encoder_free(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+// Pre-roll ring functions
+static void preroll_write(PrerollRing *r, const short *frames, size_t count) {
+    uint64_t written = atomic_load_explicit(&r->written, memory_order_relaxed);
+    if (count > r->capacity) {
+        frames += count - r->capacity;
+        written += count - r->capacity;
+        count = r->capacity;
+    }
+    size_t pos = written % r->capacity;
+    size_t first = r->capacity - pos < count ? r->capacity - pos : count;
+    memcpy(r->samples + pos, frames, first * sizeof(short));
+    memcpy(r->samples, frames + first, (count - first) * sizeof(short));
+    atomic_store_explicit(&r->written, written + count, memory_order_release);
+}
+
+// Copy out the ring's contents from frame since on, oldest first; returns the
+// number of frames in dest
+static size_t preroll_snapshot(PrerollRing *r, short *dest, uint64_t since) {
+    uint64_t end = atomic_load_explicit(&r->written, memory_order_acquire);
+    uint64_t start = end > r->capacity ? end - r->capacity : 0;
+    if (start < since) start = since < end ? since : end;
+    for (uint64_t i = start; i < end; i++) {
+        dest[i - start] = r->samples[i % r->capacity];
+    }
+
+    // Anything the writer lapped while we copied is torn: drop it from the front
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t now = atomic_load_explicit(&r->written, memory_order_relaxed);
+    size_t count = end - start;
+    if (now - start > r->capacity) {
+        size_t torn = now - start - r->capacity;
+        if (torn >= count) return 0;
+        memmove(dest, dest + torn, (count - torn) * sizeof(short));
+        count -= torn;
+    }
+    return count;
+}
+
+// Stream queue functions
+static void stream_queue_push(StreamQueue *q, const void *data, size_t size) {
+    pthread_mutex_lock(&q->lock);
+    while (size > 0 && !q->closed && !q->overflow) {
+        if (q->count == STREAM_QUEUE_SLOTS) {
+            q->overflow = 1;
+            break;
+        }
+        size_t n = size < STREAM_SLOT_BYTES ? size : STREAM_SLOT_BYTES;
+        memcpy(q->data[q->tail], data, n);
+        q->bytes[q->tail] = n;
+        q->tail = (q->tail + 1) % STREAM_QUEUE_SLOTS;
+        q->count++;
+        data = (const char *)data + n;
+        size -= n;
+    }
+    int wake = q->paused;
+    pthread_mutex_unlock(&q->lock);
+    if (wake) curl_multi_wakeup(q->multi);
+}
+
+static void stream_queue_close(StreamQueue *q, int abort) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    if (abort) q->overflow = 1;
+    pthread_mutex_unlock(&q->lock);
+    if (q->multi) curl_multi_wakeup(q->multi);
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Time since the current recording started; pairs with the release store in run_session()
+static uint64_t record_elapsed_ms(void) {
+    return monotonic_ms() - atomic_load_explicit(&g_record_start_ms, memory_order_acquire);
+}
+
+// Map the status page, creating it if needed, and clear the previous session's history
+static int status_open(void) {
+    if (!g_status) {
+        int fd = shm_open(STATUS_SHM, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+        if (fd < 0) return -1;
+        if (ftruncate(fd, sizeof(StatusBlock)) < 0) {
+            close(fd);
+            return -1;
+        }
+        void *map = mmap(NULL, sizeof(StatusBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return -1;
+        g_status = map;
+    }
+
+    pthread_mutex_lock(&g_status_lock);
+    uint32_t seq = atomic_load_explicit(&g_status->seq, memory_order_relaxed) | 1;
+    atomic_store_explicit(&g_status->seq, seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    g_status->magic = STATUS_MAGIC;
+    g_status->version = STATUS_VERSION;
+    g_status->state = STATUS_IDLE;
+    g_status->level = 0.0f;
+    g_status->elapsed_ms = 0;
+    g_status->history_head = 0;
+    memset(g_status->history, 0, sizeof(g_status->history));
+    g_status->message[0] = '\0';
+    g_status->partial[0] = '\0';
+    atomic_store_explicit(&g_status->seq, seq + 1, memory_order_release);
+    pthread_mutex_unlock(&g_status_lock);
+    return 0;
+}
+
+static void status_close(int remove) {
+    if (g_status) munmap(g_status, sizeof(StatusBlock));
+    g_status = NULL;
+    if (remove) shm_unlink(STATUS_SHM);
+}
+
+// Seqlock write side; the mutex only orders our own writer threads
+static void status_write_begin(void) {
+    pthread_mutex_lock(&g_status_lock);
+    uint32_t seq = atomic_load_explicit(&g_status->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_status->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void status_write_end(void) {
+    g_status->elapsed_ms = (uint32_t)record_elapsed_ms();
+    uint32_t seq = atomic_load_explicit(&g_status->seq, memory_order_relaxed);
+    atomic_store_explicit(&g_status->seq, seq + 1, memory_order_release);
+    pthread_mutex_unlock(&g_status_lock);
+}
+
+// Publish a state change; message is shown with STATUS_ERROR
+static void update_status(StatusState state, const char *message) {
+    if (!g_status) return;
+    status_write_begin();
+    g_status->state = state;
+    snprintf(g_status->message, sizeof(g_status->message), "%s", message ? message : "");
+    status_write_end();
+}
+
+// A session still finishing after a newer one started leaves the status page to it
+static int session_in_front(const Session *s) {
+    return s->seq == atomic_load(&g_session_seq);
+}
+
+static void session_status(const Session *s, StatusState state, const char *message) {
+    if (session_in_front(s)) update_status(state, message);
+}
+
+// Publish the live transcript; only its tail fits, cut on a UTF-8 character boundary
+static void status_set_partial(const char *text) {
+    if (!g_status) return;
+    size_t len = strlen(text);
+    if (len >= STATUS_PARTIAL) {
+        text += len - (STATUS_PARTIAL - 1);
+        while ((*text & 0xC0) == 0x80) text++;
+    }
+    status_write_begin();
+    snprintf(g_status->partial, sizeof(g_status->partial), "%s", text);
+    status_write_end();
+}
+
+// Publish one period's level; called from the capture thread
+static void status_push_level(float level) {
+    if (!g_status) return;
+    status_write_begin();
+    g_status->level = level;
+    g_status->history[g_status->history_head % STATUS_HISTORY] = level;
+    g_status->history_head++;
+    status_write_end();
+}
+
+// Overlay - a Python GTK window fed from the status page. The script goes in on
+// stdin so nothing is written to disk; a persistent overlay (daemon mode) is started
+// once and shows or hides itself as sessions come and go.
+static pid_t spawn_overlay(int persistent) {
+    static const char viz_script[] =
+        "#!/usr/bin/env python3\n"
+        "import gi\n"
+        "gi.require_version('Gtk', '3.0')\n"
+        "from gi.repository import Gtk, Gdk, GLib\n"
+        "import cairo\n"
+        "import math, time, os, sys, mmap, struct\n"
         "\n"
-        "if os.path.exists('/tmp/voice_transcribe.status'):\n"
-        "    window = AudioVisualizer()\n"
-        "    window.connect('destroy', Gtk.main_quit)\n"
-        "    Gtk.main()\n";
+        "STATUS = '/dev/shm/voice_transcribe.status'\n"
+        "LAYOUT = struct.Struct('<IIIIfII64f64s1024s')\n"
+        "STATES = ['IDLE', 'CONNECTING', 'READY', 'RECORDING', 'PROCESSING', 'UPLOADING',\n"
+        "          'COPIED', 'FAILED', 'NO_AUDIO', 'MAX_TIME', 'ERROR', 'TRANSCRIBING', 'SPOOLED']\n"
+        "LINGER = {'COPIED': 1000, 'FAILED': 2000, 'NO_AUDIO': 2000, 'SPOOLED': 2000}\n"
+        "PERSISTENT = '--persistent' in sys.argv\n"
+        "\n"
+        "# (top, bottom) colour stops for quiet, medium and loud bars\n"
+        "BAR_COLOURS = [\n"
+        "    ((0.3, 0.7, 1.0, 0.9), (0.1, 0.4, 0.8, 0.7)),\n"
+        "    ((0.9, 0.3, 1.0, 0.9), (0.6, 0.1, 0.8, 0.7)),\n"
+        "    ((1.0, 0.3, 0.3, 0.9), (0.8, 0.1, 0.1, 0.7)),\n"
+        "]\n"
+        "\n"
+        "def read_status(mm):\n"
+        "    # Seqlock read: retry while a write is in progress or one landed mid-copy\n"
+        "    for _ in range(100):\n"
+        "        seq = struct.unpack_from('<I', mm, 8)[0]\n"
+        "        if seq & 1: continue\n"
+        "        fields = LAYOUT.unpack_from(mm, 0)\n"
+        "        if struct.unpack_from('<I', mm, 8)[0] == seq: return fields\n"
+        "    return None\n"
+        "\n"
+        "class AudioVisualizer(Gtk.Window):\n"
+        "    def __init__(self):\n"
+        "        super().__init__()\n"
+        "        self.set_title('Recording')\n"
+        "        self.set_type_hint(Gdk.WindowTypeHint.NOTIFICATION)\n"
+        "        self.set_default_size(400, 100)\n"
+        "        self.set_decorated(False)\n"
+        "        self.set_keep_above(True)\n"
+        "        self.set_app_paintable(True)\n"
+        "        screen = self.get_screen()\n"
+        "        visual = screen.get_rgba_visual()\n"
+        "        if visual: self.set_visual(visual)\n"
+        "        \n"
+        "        # Center on screen\n"
+        "        self.set_position(Gtk.WindowPosition.CENTER)\n"
+        "        self.stick()  # Show on all workspaces\n"
+        "        self.set_skip_taskbar_hint(True)\n"
+        "        self.set_skip_pager_hint(True)\n"
+        "        \n"
+        "        # Make click-through and non-focusable\n"
+        "        self.set_events(0)\n"
+        "        self.input_shape_combine_region(None)\n"
+        "        self.set_accept_focus(False)\n"
+        "        self.set_can_focus(False)\n"
+        "        \n"
+        "        self.drawing_area = Gtk.DrawingArea()\n"
+        "        self.drawing_area.connect('draw', self.on_draw)\n"
+        "        self.add(self.drawing_area)\n"
+        "        self.drawing_area.show()\n"
+        "        \n"
+        "        self.level = 0.0\n"
+        "        self.time_str = '00:00'\n"
+        "        self.status = 'IDLE'\n"
+        "        self.history = [0.0] * 64\n"
+        "        self.message = ''\n"
+        "        self.partial = ''\n"
+        "        self.linger = None\n"
+        "        self.gradients = None\n"
+        "        self.gradient_height = 0\n"
+        "        fd = os.open(STATUS, os.O_RDONLY)\n"
+        "        self.mm = mmap.mmap(fd, LAYOUT.size, mmap.MAP_SHARED, mmap.PROT_READ)\n"
+        "        os.close(fd)\n"
+        "        \n"
+        "        GLib.timeout_add(50, self.update_display)\n"
+        "    \n"
+        "    def finish(self):\n"
+        "        # A one-shot overlay exits; the daemon's copy hides until the next session\n"
+        "        self.linger = None\n"
+        "        if not PERSISTENT:\n"
+        "            Gtk.main_quit()\n"
+        "        elif self.status in LINGER or self.status == 'IDLE':\n"
+        "            self.hide()\n"
+        "        return False\n"
+        "    \n"
+        "    def update_display(self):\n"
+        "        fields = read_status(self.mm)\n"
+        "        if not fields:\n"
+        "            return True\n"
+        "        state, level, elapsed, head = fields[3:7]\n"
+        "        status = STATES[state] if state < len(STATES) else 'ERROR'\n"
+        "        self.message = fields[-2].split(b'\\0', 1)[0].decode('utf-8', 'replace')\n"
+        "        self.partial = fields[-1].split(b'\\0', 1)[0].decode('utf-8', 'replace')\n"
+        "        \n"
+        "        if status in ('IDLE',) + tuple(LINGER):\n"
+        "            # Keep showing the result for a moment, then get out of the way\n"
+        "            if status != 'IDLE': self.status = status\n"
+        "            if self.linger is None:\n"
+        "                if self.get_visible():\n"
+        "                    self.drawing_area.queue_draw()\n"
+        "                    self.linger = GLib.timeout_add(LINGER.get(self.status, 0), self.finish)\n"
+        "                elif not PERSISTENT and status != 'IDLE':\n"
+        "                    Gtk.main_quit()\n"
+        "            return True\n"
+        "        \n"
+        "        if self.linger is not None:\n"
+        "            GLib.source_remove(self.linger)\n"
+        "            self.linger = None\n"
+        "        self.status = status\n"
+        "        self.level = level\n"
+        "        self.time_str = '%02d:%02d' % (elapsed // 60000, elapsed // 1000 % 60)\n"
+        "        # Oldest first; the ring carries every period, not just what a 50 ms poll caught\n"
+        "        ring = fields[7:7 + 64]\n"
+        "        self.history = [ring[(head + i) % 64] for i in range(64)]\n"
+        "        if not self.get_visible():\n"
+        "            self.show()\n"
+        "        self.drawing_area.queue_draw()\n"
+        "        return True\n"
+        "    \n"
+        "    def bar_gradients(self, height):\n"
+        "        # One gradient per colour band spanning the tallest possible bar, rebuilt only on resize\n"
+        "        if self.gradient_height != height:\n"
+        "            top = height * 0.15\n"
+        "            bottom = height * 0.85\n"
+        "            self.gradients = []\n"
+        "            for start, end in BAR_COLOURS:\n"
+        "                gradient = cairo.LinearGradient(0, top, 0, bottom)\n"
+        "                gradient.add_color_stop_rgba(0, *start)\n"
+        "                gradient.add_color_stop_rgba(1, *end)\n"
+        "                self.gradients.append(gradient)\n"
+        "            self.gradient_height = height\n"
+        "        return self.gradients\n"
+        "    \n"
+        "    def on_draw(self, widget, cr):\n"
+        "        width = widget.get_allocated_width()\n"
+        "        height = widget.get_allocated_height()\n"
+        "        \n"
+        "        # Clear background properly\n"
+        "        cr.set_operator(cairo.OPERATOR_SOURCE)\n"
+        "        cr.set_source_rgba(0.1, 0.1, 0.2, 0.95)\n"
+        "        cr.paint()\n"
+        "        cr.set_operator(cairo.OPERATOR_OVER)\n"
+        "        \n"
+        "        # Draw border\n"
+        "        cr.set_line_width(1)\n"
+        "        cr.set_source_rgba(0.3, 0.3, 0.5, 0.5)\n"
+        "        cr.rectangle(0.5, 0.5, width-1, height-1)\n"
+        "        cr.stroke()\n"
+        "        \n"
+        "        # Draw waveform bars, one path and one fill per colour band\n"
+        "        gradients = self.bar_gradients(height)\n"
+        "        bar_width = width / len(self.history)\n"
+        "        for band, gradient in enumerate(gradients):\n"
+        "            for i, level in enumerate(self.history):\n"
+        "                if (2 if level > 0.7 else 1 if level > 0.4 else 0) != band: continue\n"
+        "                bar_height = height * level * 0.7\n"
+        "                y = (height - bar_height) / 2\n"
+        "                cr.rectangle(i * bar_width + 1, y, bar_width - 2, bar_height)\n"
+        "            cr.set_source(gradient)\n"
+        "            cr.fill()\n"
+        "        \n"
+        "        # Draw status text with background\n"
+        "        cr.select_font_face('Sans')\n"
+        "        \n"
+        "        # Status message in center-bottom\n"
+        "        status_text = {\n"
+        "            'CONNECTING': 'Connecting to microphone...',\n"
+        "            'READY': 'Microphone ready',\n"
+        "            'RECORDING': 'Recording...',\n"
+        "            'PROCESSING': 'Processing...',\n"
+        "            'UPLOADING': 'Uploading to OpenAI...',\n"
+        "            'TRANSCRIBING': 'Transcribing...',\n"
+        "            'SPOOLED': 'Offline - saved, will retry',\n"
+        "            'COPIED': 'Copied to clipboard!',\n"
+        "            'FAILED': 'Transcription failed',\n"
+        "            'NO_AUDIO': 'No audio recorded',\n"
+        "            'MAX_TIME': 'Max time reached',\n"
+        "            'ERROR': self.message or 'Error occurred'\n"
+        "        }.get(self.status, self.status)\n"
+        "        \n"
+        "        cr.set_font_size(13)\n"
+        "        text_extents = cr.text_extents(status_text)\n"
+        "        text_x = (width - text_extents.width) / 2\n"
+        "        text_y = height - 10\n"
+        "        \n"
+        "        # Text background\n"
+        "        cr.set_source_rgba(0.0, 0.0, 0.0, 0.6)\n"
+        "        cr.rectangle(text_x - 5, text_y - text_extents.height - 2, text_extents.width + 10, text_extents.height + 4)\n"
+        "        cr.fill()\n"
+        "        \n"
+        "        # Status text\n"
+        "        if self.status == 'COPIED':\n"
+        "            cr.set_source_rgba(0.0, 1.0, 0.5, 1.0)\n"
+        "        elif self.status in ['FAILED', 'ERROR']:\n"
+        "            cr.set_source_rgba(1.0, 0.3, 0.3, 1.0)\n"
+        "        elif self.status in ['UPLOADING', 'PROCESSING', 'TRANSCRIBING', 'SPOOLED']:\n"
+        "            cr.set_source_rgba(1.0, 0.8, 0.2, 1.0)\n"
+        "        else:\n"
+        "            cr.set_source_rgba(1.0, 1.0, 1.0, 0.9)\n"
+        "        cr.move_to(text_x, text_y)\n"
+        "        cr.show_text(status_text)\n"
+        "        \n"
+        "        # Live transcript above the status line, then the result; cut from the left to fit\n"
+        "        if self.partial and self.status in ['RECORDING', 'PROCESSING', 'UPLOADING', 'TRANSCRIBING', 'COPIED']:\n"
+        "            cr.set_font_size(12)\n"
+        "            text = self.partial\n"
+        "            while len(text) > 1 and cr.text_extents(text).x_advance > width - 20:\n"
+        "                text = text[max(1, len(text) // 8):]\n"
+        "            if text != self.partial: text = '\\u2026' + text.lstrip()\n"
+        "            extents = cr.text_extents(text)\n"
+        "            cr.set_source_rgba(0.0, 0.0, 0.0, 0.6)\n"
+        "            cr.rectangle(5, height - 47, width - 10, extents.height + 8)\n"
+        "            cr.fill()\n"
+        "            cr.set_source_rgba(0.9, 0.9, 1.0, 0.95)\n"
+        "            cr.move_to(10, height - 43 + extents.height)\n"
+        "            cr.show_text(text)\n"
+        "        \n"
+        "        # Time in top-right\n"
+        "        if self.status == 'RECORDING':\n"
+        "            cr.set_font_size(11)\n"
+        "            cr.set_source_rgba(0.8, 0.8, 0.8, 0.7)\n"
+        "            cr.move_to(width - 45, 15)\n"
+        "            cr.show_text(self.time_str)\n"
+        "            \n"
+        "            # Recording dot animation\n"
+        "            cr.set_source_rgba(1.0, 0.0, 0.0, 0.5 + 0.5 * math.sin(time.time() * 5))\n"
+        "            cr.arc(15, 15, 4, 0, 2 * math.pi)\n"
+        "            cr.fill()\n"
+        "\n"
+        "if os.path.exists(STATUS):\n"
+        "    window = AudioVisualizer()\n"
+        "    window.connect('destroy', Gtk.main_quit)\n"
+        "    Gtk.main()\n";
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // dup2 clears close-on-exec on the new descriptors
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(fds[0], STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        nice(10); // keep the UI off the capture thread's back
+        execlp("python3", "python3", "-", persistent ? "--persistent" : (char *)NULL, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+
+    if (pid > 0) {
+        size_t off = 0;
+        while (off < sizeof(viz_script) - 1) {
+            ssize_t n = write(fds[1], viz_script + off, sizeof(viz_script) - 1 - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
+        }
+    }
+    close(fds[1]);
+    return pid;
+}
+
+// Make sure the daemon's overlay is running, restarting it if it died
+static void ensure_overlay(void) {
+    if (g_overlay_pid > 0 && waitpid(g_overlay_pid, NULL, WNOHANG) == 0) return;
+    g_overlay_pid = spawn_overlay(1);
+}
+
+static void stop_overlay(void) {
+    if (g_overlay_pid <= 0) return;
+    kill(g_overlay_pid, SIGTERM);
+    waitpid(g_overlay_pid, NULL, 0);
+    g_overlay_pid = -1;
+}
+
+// Per-user directories: $XDG_<kind>_HOME/voice-transcribe, or the XDG default under ~
+static void xdg_dir(char *path, size_t size, const char *variable, const char *fallback) {
+    const char *xdg = getenv(variable);
+    const char *home = getenv("HOME");
+    if (xdg && xdg[0]) snprintf(path, size, "%s/voice-transcribe", xdg);
+    else snprintf(path, size, "%s/%s/voice-transcribe", home ? home : "/tmp", fallback);
+}
+
+static const char *config_dir(void) {
+    static char path[256];
+    if (!path[0]) xdg_dir(path, sizeof(path), "XDG_CONFIG_HOME", ".config");
+    return path;
+}
+
+static const char *state_dir(void) {
+    static char path[256];
+    if (!path[0]) xdg_dir(path, sizeof(path), "XDG_STATE_HOME", ".local/state");
+    return path;
+}
+
+static const char *cache_dir(void) {
+    static char path[256];
+    if (!path[0]) xdg_dir(path, sizeof(path), "XDG_CACHE_HOME", ".cache");
+    return path;
+}
+
+// mkdir -p
+static int make_dirs(const char *path) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(buf, 0700) < 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(buf, 0700) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+// The daemon's control socket: $XDG_RUNTIME_DIR/voice-transcribe.sock, or inside a
+// private /tmp/voice-transcribe-<uid> directory. NULL if that directory exists but is
+// not ours and 0700, since anyone could have planted a socket in it
+static const char *control_socket_path(void) {
+    static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    if (path[0]) return path;
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && runtime[0]) {
+        snprintf(path, sizeof(path), "%s/voice-transcribe.sock", runtime);
+        return path;
+    }
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/voice-transcribe-%u", (unsigned)getuid());
+    struct stat st;
+    if ((mkdir(dir, 0700) < 0 && errno != EEXIST) || lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != getuid() || (st.st_mode & 0777) != 0700) {
+        fprintf(stderr, "Unsafe control socket directory %s\n", dir);
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/control.sock", dir);
+    return path;
+}
+
+// Capture converter functions
+static void converter_free(CaptureConverter *c) {
+    free(c->raw);
+    free(c->mono);
+    free(c->filter);
+    memset(c, 0, sizeof(*c));
+    c->passthrough = 1;
+}
+
+static unsigned gcd(unsigned a, unsigned b) {
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int converter_init(CaptureConverter *c, unsigned rate, unsigned channels, int sample_bytes) {
+    converter_free(c);
+    c->rate = rate;
+    c->channels = channels;
+    c->sample_bytes = sample_bytes;
+    c->passthrough = rate == SAMPLE_RATE && channels == CHANNELS && sample_bytes == 2;
+    if (c->passthrough) return 0;
+
+    unsigned g = gcd(SAMPLE_RATE, rate);
+    c->up = SAMPLE_RATE / g;
+    c->down = rate / g;
+    c->max_read = (BUFFER_SIZE - 1) * (size_t)c->down / c->up;
+    if (c->max_read > BUFFER_SIZE) c->max_read = BUFFER_SIZE;
+
+    // Decimating needs a filter as many times longer as the rate drops
+    c->taps = RESAMPLER_TAPS * ((c->down + c->up - 1) / c->up);
+    if (c->taps > RESAMPLER_MAX_TAPS) c->taps = RESAMPLER_MAX_TAPS;
+
+    c->raw = malloc(c->max_read * channels * sample_bytes);
+    c->mono = calloc(c->taps - 1 + c->max_read, sizeof(float));
+    c->filter = malloc((size_t)c->up * c->taps * sizeof(float));
+    if (!c->raw || !c->mono || !c->filter) {
+        converter_free(c);
+        return -1;
+    }
+
+    // Low-pass at the upsampled rate, cut a little below the lower Nyquist limit,
+    // Blackman-windowed; the gain of up makes up for the zeros interpolation inserts
+    size_t length = (size_t)c->up * c->taps;
+    double cutoff = 0.45 / (c->up > c->down ? c->up : c->down);
+    for (size_t p = 0; p < c->up; p++) {
+        for (size_t t = 0; t < c->taps; t++) {
+            size_t k = p + (c->taps - 1 - t) * c->up;
+            double x = k - (length - 1) / 2.0;
+            double sinc = x == 0.0 ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            double window = 0.42 - 0.5 * cos(2 * M_PI * k / (length - 1)) + 0.08 * cos(4 * M_PI * k / (length - 1));
+            c->filter[p * c->taps + t] = (float)(c->up * 2 * cutoff * sinc * window);
+        }
+    }
+    c->pos = 0;
+    return 0;
+}
+
+// Turn frames of device audio in c->raw into pipeline samples; returns how many
+static size_t converter_run(CaptureConverter *c, size_t frames, short *out) {
+    float *x = c->mono + c->taps - 1;
+    float scale = (c->sample_bytes == 4 ? 1.0f / 65536.0f : 1.0f) / c->channels;
+    for (size_t i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        for (unsigned ch = 0; ch < c->channels; ch++) {
+            size_t at = i * c->channels + ch;
+            sum += c->sample_bytes == 4 ? (float)((const int32_t *)c->raw)[at] : ((const short *)c->raw)[at];
+        }
+        x[i] = sum * scale;
+    }
+
+    size_t n = 0;
+    for (; c->pos / c->up < frames; c->pos += c->down) {
+        size_t i = c->pos / c->up;
+        float v = g_dsp->dot(x + i - (c->taps - 1), c->filter + (c->pos % c->up) * c->taps, c->taps);
+        out[n++] = v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (short)lrintf(v);
+    }
+    c->pos -= (uint64_t)frames * c->up;
+    memmove(c->mono, c->mono + frames, (c->taps - 1) * sizeof(float));
+    return n;
+}
+
+// Negotiate the device's own rate, channels and sample format, or apply a cached
+// setup exactly. ALSA's resampler stays out of the way and the result is read back
+// into *params rather than assumed.
+static int configure_capture_device(snd_pcm_t *handle, CaptureParams *params, int cached) {
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_hw_params_any(handle, hw_params);
+
+    int err;
+    snd_pcm_format_t format = cached ? params->format : SND_PCM_FORMAT_S16_LE;
+    if (!cached && snd_pcm_hw_params_test_format(handle, hw_params, format) < 0) format = SND_PCM_FORMAT_S32_LE;
+    unsigned channels = cached ? params->channels : CHANNELS;
+    unsigned rate = cached ? params->rate : g_capture_rate ? g_capture_rate : SAMPLE_RATE;
+    if ((err = snd_pcm_hw_params_set_access(handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_resample(handle, hw_params, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(handle, hw_params, format)) < 0) {
+        return err;
+    }
+    if (cached) {
+        if ((err = snd_pcm_hw_params_set_channels(handle, hw_params, channels)) < 0 ||
+            (err = snd_pcm_hw_params_set_rate(handle, hw_params, rate, 0)) < 0) {
+            return err;
+        }
+    } else {
+        if (!g_capture_rate && snd_pcm_hw_params_test_rate(handle, hw_params, rate, 0) < 0) rate = CAPTURE_FALLBACK_RATE;
+        if ((err = snd_pcm_hw_params_set_channels_near(handle, hw_params, &channels)) < 0 ||
+            (err = snd_pcm_hw_params_set_rate_near(handle, hw_params, &rate, 0)) < 0) {
+            return err;
+        }
+    }
+
+    // Fixed, known period so the capture loop wakes once per period instead of spinning;
+    // PERIOD_FRAMES is in pipeline frames, so it means the same time at any rate
+    snd_pcm_uframes_t period = (snd_pcm_uframes_t)g_period_frames * rate / SAMPLE_RATE;
+    snd_pcm_uframes_t buffer_size = period * PERIODS_PER_BUFFER;
+    snd_pcm_hw_params_set_period_size_near(handle, hw_params, &period, NULL);
+    snd_pcm_hw_params_set_buffer_size_near(handle, hw_params, &buffer_size);
+
+    if ((err = snd_pcm_hw_params(handle, hw_params)) < 0) return err;
+
+    snd_pcm_hw_params_get_rate(hw_params, &params->rate, NULL);
+    snd_pcm_hw_params_get_channels(hw_params, &params->channels);
+    snd_pcm_hw_params_get_format(hw_params, &params->format);
+    if (params->channels == 0 || params->channels > CAPTURE_MAX_CHANNELS ||
+        (params->format != SND_PCM_FORMAT_S16_LE && params->format != SND_PCM_FORMAT_S32_LE)) {
+        return -EINVAL;
+    }
+    if (converter_init(&g_converter, params->rate, params->channels,
+                       params->format == SND_PCM_FORMAT_S32_LE ? 4 : 2) < 0) {
+        return -ENOMEM;
+    }
+    if (!g_converter.passthrough && !cached) {
+        fprintf(stderr, "Capturing from %s at %u Hz, %u channel(s), %d-bit; converting to %d Hz mono\n",
+                params->device, params->rate, params->channels, g_converter.sample_bytes * 8, SAMPLE_RATE);
+    }
+
+    // Wake up when a full period is available
+    snd_pcm_hw_params_get_period_size(hw_params, &period, NULL);
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_sw_params_alloca(&sw_params);
+    snd_pcm_sw_params_current(handle, sw_params);
+    snd_pcm_sw_params_set_avail_min(handle, sw_params, period);
+    snd_pcm_sw_params(handle, sw_params);
+    return 0;
+}
+
+static int try_capture_device(CaptureParams *params, int cached, snd_pcm_t **out) {
+    snd_pcm_t *handle;
+    int err = snd_pcm_open(&handle, params->device, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
+    if (err < 0) return err;
+    if ((err = configure_capture_device(handle, params, cached)) < 0) {
+        snd_pcm_close(handle);
+        return err;
+    }
+    snd_pcm_prepare(handle);
+    *out = handle;
+    return 0;
+}
+
+// Device probe cache, $XDG_CACHE_HOME/voice-transcribe/capture:
+//   VTCAP1 <CAPTURE_DEVICE or *> <CAPTURE_RATE> <device> <rate> <channels> <format>
+// It only applies while those two settings are unchanged.
+static void capture_cache_path(char *path, size_t size) {
+    snprintf(path, size, "%s/capture", cache_dir());
+}
+
+static int capture_cache_load(CaptureParams *params) {
+    char path[300], wanted[64];
+    capture_cache_path(path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    unsigned wanted_rate;
+    int format;
+    int ok = fscanf(fp, "VTCAP1 %63s %u %63s %u %u %d", wanted, &wanted_rate, params->device,
+                    &params->rate, &params->channels, &format) == 6 &&
+             strcmp(wanted, g_capture_device ? g_capture_device : "*") == 0 && wanted_rate == g_capture_rate;
+    fclose(fp);
+    params->format = (snd_pcm_format_t)format;
+    return ok ? 0 : -1;
+}
+
+static void capture_cache_save(const CaptureParams *params) {
+    char path[300];
+    if (make_dirs(cache_dir()) < 0) return;
+    capture_cache_path(path, sizeof(path));
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    fprintf(fp, "VTCAP1 %s %u %s %u %u %d\n", g_capture_device ? g_capture_device : "*", g_capture_rate,
+            params->device, params->rate, params->channels, (int)params->format);
+    fclose(fp);
+}
+
+// Open and configure the capture device, leaving it prepared. A cached setup is
+// tried first; otherwise CAPTURE_DEVICE, or a probe: the raw card first so its real
+// capabilities are visible, then plughw, which only adapts the sample format, and
+// "default" (maybe PulseAudio) as the last resort.
+static int open_capture_device(snd_pcm_t **out) {
+    CaptureParams params;
+    char path[300];
+    if (capture_cache_load(&params) == 0) {
+        if (try_capture_device(&params, 1, out) == 0) return 0;
+        capture_cache_path(path, sizeof(path));
+        unlink(path); // the device changed or is gone: probe again
+    }
+
+    const char *probe[] = { "hw:0,0", "plughw:0,0", "default" };
+    size_t count = sizeof(probe) / sizeof(probe[0]);
+    if (g_capture_device) {
+        probe[0] = g_capture_device;
+        count = 1;
+    }
+    int err = -ENODEV;
+    for (size_t i = 0; i < count; i++) {
+        snprintf(params.device, sizeof(params.device), "%s", probe[i]);
+        if ((err = try_capture_device(&params, 0, out)) == 0) {
+            capture_cache_save(&params);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Cannot open audio device: %s\n", snd_strerror(err));
+    return err;
+}
+
+// One non-blocking read, converted to the pipeline format: frames (possibly 0 when
+// the read was too short to complete an output sample), or -EAGAIN / an error
+static int capture_readi(snd_pcm_t *pcm, short *buffer) {
+    if (g_converter.passthrough) return snd_pcm_readi(pcm, buffer, BUFFER_SIZE);
+    snd_pcm_sframes_t frames = snd_pcm_readi(pcm, g_converter.raw, g_converter.max_read);
+    return frames > 0 ? (int)converter_run(&g_converter, frames, buffer) : (int)frames;
+}
+
+// Ask the capture loop to stop; safe to call from a signal handler
+static void request_stop(void) {
+    if (!atomic_load(&g_stop_ms)) atomic_store(&g_stop_ms, monotonic_ms());
+    g_stop_recording = 1;
+    if (g_wakeup_fd >= 0) {
+        uint64_t one = 1;
+        write(g_wakeup_fd, &one, sizeof(one));
+    }
+}
+
+// Sleep in poll() until the device has a period ready (or a stop request / timeout
+// arrives), then read what is available. Returns frames read, 0 when there is
+// nothing to read, or a negative error the device could not recover from.
+static int capture_read(snd_pcm_t *pcm, short *buffer, int timeout_ms) {
+    struct pollfd fds[9];
+    int count = snd_pcm_poll_descriptors_count(pcm);
+    if (count < 0) return count;
+    if (count > 8) count = 8;
+
+    for (;;) {
+        int frames = capture_readi(pcm, buffer);
+        if (frames >= 0) return frames;
+        if (frames != -EAGAIN) {
+            frames = snd_pcm_recover(pcm, frames, 1);
+            if (frames < 0) return frames;
+            continue;
+        }
+
+        snd_pcm_poll_descriptors(pcm, fds, count);
+        fds[count] = (struct pollfd){ .fd = g_wakeup_fd, .events = POLLIN };
+        int nfds = count + (g_wakeup_fd >= 0 ? 1 : 0);
+        if (poll(fds, nfds, timeout_ms) <= 0) return 0;
+
+        if (nfds > count && fds[count].revents) {
+            uint64_t value;
+            read(g_wakeup_fd, &value, sizeof(value));
+            return 0;
+        }
+
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents(pcm, fds, count, &revents);
+        if (!(revents & (POLLIN | POLLERR))) return 0;
+    }
+}
+
+// ALSA source: the probed or configured device, converted in-process
+static int alsa_open(void) {
+    return open_capture_device(&g_alsa_pcm);
+}
+
+static void alsa_start(void) {
+    if (snd_pcm_state(g_alsa_pcm) == SND_PCM_STATE_PREPARED) snd_pcm_start(g_alsa_pcm);
+}
+
+static int alsa_read(short *buffer, int timeout_ms) {
+    return capture_read(g_alsa_pcm, buffer, timeout_ms);
+}
+
+static int alsa_read_nowait(short *buffer) {
+    return capture_readi(g_alsa_pcm, buffer);
+}
+
+static void alsa_stop(void) {
+    snd_pcm_drop(g_alsa_pcm);
+    snd_pcm_prepare(g_alsa_pcm);
+}
+
+static void alsa_close(void) {
+    snd_pcm_close(g_alsa_pcm);
+    g_alsa_pcm = NULL;
+}
+
+#ifdef HAVE_PIPEWIRE
+// PipeWire source: a capture stream the graph converts to the pipeline format, with
+// a quantum of one period. It shares the device with everything else, so there is
+// no exclusive open to fail on a busy card. process() runs on PipeWire's loop
+// thread and only signals an eventfd; reads dequeue under the loop lock and copy
+// straight out of the mapped buffers.
+static struct {
+    struct pw_thread_loop *loop;
+    struct pw_stream *stream;
+    struct pw_buffer *pending;  // partly read; queued back once emptied
+    size_t offset;              // frames of pending already read
+    int data_fd;                // eventfd: a buffer is ready to dequeue
+    atomic_int failed;
+} g_pw = { .data_fd = -1 };
+
+static void pipewire_notify(void) {
+    uint64_t one = 1;
+    write(g_pw.data_fd, &one, sizeof(one));
+}
+
+static void pipewire_state_changed(void *data, enum pw_stream_state old, enum pw_stream_state state,
+                                   const char *error) {
+    (void)data;
+    (void)old;
+    if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        if (error) fprintf(stderr, "PipeWire capture: %s\n", error);
+        atomic_store(&g_pw.failed, 1);
+        pipewire_notify();
+    }
+    pw_thread_loop_signal(g_pw.loop, 0);
+}
+
+static void pipewire_process(void *data) {
+    (void)data;
+    pipewire_notify();
+}
+
+static const struct pw_stream_events g_pw_events = {
+    PW_VERSION_STREAM_EVENTS,
+    .state_changed = pipewire_state_changed,
+    .process = pipewire_process,
+};
+
+static void pipewire_close(void) {
+    if (g_pw.loop) pw_thread_loop_stop(g_pw.loop);
+    if (g_pw.stream) pw_stream_destroy(g_pw.stream);
+    if (g_pw.loop) pw_thread_loop_destroy(g_pw.loop);
+    if (g_pw.data_fd >= 0) close(g_pw.data_fd);
+    g_pw.loop = NULL;
+    g_pw.stream = NULL;
+    g_pw.pending = NULL;
+    g_pw.offset = 0;
+    g_pw.data_fd = -1;
+    pw_deinit();
+}
+
+// Connect an inactive stream and wait until the graph has linked it (or refused)
+static int pipewire_open(void) {
+    pw_init(NULL, NULL);
+    atomic_store(&g_pw.failed, 0);
+    g_pw.data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    g_pw.loop = pw_thread_loop_new("voice-capture", NULL);
+    if (g_pw.data_fd < 0 || !g_pw.loop) {
+        pipewire_close();
+        return -ENOMEM;
+    }
+
+    struct pw_properties *props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio", PW_KEY_MEDIA_CATEGORY, "Capture",
+                                                    PW_KEY_MEDIA_ROLE, "Communication", NULL);
+    pw_properties_setf(props, PW_KEY_NODE_LATENCY, "%d/%d", g_period_frames, SAMPLE_RATE);
+    if (g_capture_device) pw_properties_set(props, PW_KEY_TARGET_OBJECT, g_capture_device);
+
+    uint8_t pod[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(pod, sizeof(pod));
+    const struct spa_pod *formats[1];
+    formats[0] = spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat,
+                                            &SPA_AUDIO_INFO_RAW_INIT(.format = SPA_AUDIO_FORMAT_S16, .channels = 1,
+                                                                     .rate = SAMPLE_RATE,
+                                                                     .position = { SPA_AUDIO_CHANNEL_MONO }));
+
+    enum pw_stream_state state = PW_STREAM_STATE_ERROR;
+    pw_thread_loop_lock(g_pw.loop);
+    if (pw_thread_loop_start(g_pw.loop) == 0) {
+        g_pw.stream = pw_stream_new_simple(pw_thread_loop_get_loop(g_pw.loop), "voice-transcribe", props,
+                                           &g_pw_events, NULL);
+        props = NULL; // owned by the stream now, even on failure
+        if (g_pw.stream &&
+            pw_stream_connect(g_pw.stream, PW_DIRECTION_INPUT, PW_ID_ANY,
+                              PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_INACTIVE,
+                              formats, 1) == 0) {
+            while ((state = pw_stream_get_state(g_pw.stream, NULL)) == PW_STREAM_STATE_CONNECTING &&
+                   !atomic_load(&g_pw.failed)) {
+                if (pw_thread_loop_timed_wait(g_pw.loop, 2) != 0) break;
+            }
+        }
+    }
+    pw_thread_loop_unlock(g_pw.loop);
+    if (props) pw_properties_free(props);
+
+    if (state != PW_STREAM_STATE_PAUSED && state != PW_STREAM_STATE_STREAMING) {
+        pipewire_close();
+        return -ENODEV;
+    }
+    converter_free(&g_converter); // the graph already converts
+    return 0;
+}
+
+static void pipewire_start(void) {
+    pw_thread_loop_lock(g_pw.loop);
+    pw_stream_set_active(g_pw.stream, true);
+    pw_thread_loop_unlock(g_pw.loop);
+}
+
+static int pipewire_read_nowait(short *buffer) {
+    int frames = 0;
+    pw_thread_loop_lock(g_pw.loop);
+    while (frames < BUFFER_SIZE) {
+        if (!g_pw.pending && !(g_pw.pending = pw_stream_dequeue_buffer(g_pw.stream))) break;
+        struct spa_data *d = &g_pw.pending->buffer->datas[0];
+        size_t avail = d->data && d->chunk ? d->chunk->size / sizeof(short) : 0;
+        size_t n = avail - g_pw.offset;
+        if (n > (size_t)(BUFFER_SIZE - frames)) n = BUFFER_SIZE - frames;
+        if (n > 0) {
+            memcpy(buffer + frames, (const short *)((const char *)d->data + d->chunk->offset) + g_pw.offset,
+                   n * sizeof(short));
+        }
+        frames += n;
+        g_pw.offset += n;
+        if (g_pw.offset >= avail) {
+            pw_stream_queue_buffer(g_pw.stream, g_pw.pending);
+            g_pw.pending = NULL;
+            g_pw.offset = 0;
+        }
+    }
+    pw_thread_loop_unlock(g_pw.loop);
+    if (frames > 0) return frames;
+    return atomic_load(&g_pw.failed) ? -EIO : -EAGAIN;
+}
+
+// Same contract as capture_read(): sleep until PipeWire hands over a buffer, a stop
+// request arrives or the timeout passes
+static int pipewire_read(short *buffer, int timeout_ms) {
+    for (;;) {
+        int frames = pipewire_read_nowait(buffer);
+        if (frames != -EAGAIN) return frames;
+
+        struct pollfd fds[2] = {
+            { .fd = g_pw.data_fd, .events = POLLIN },
+            { .fd = g_wakeup_fd, .events = POLLIN },
+        };
+        if (poll(fds, g_wakeup_fd >= 0 ? 2 : 1, timeout_ms) <= 0) return 0;
+
+        uint64_t value;
+        if (fds[1].revents) {
+            read(g_wakeup_fd, &value, sizeof(value));
+            return 0;
+        }
+        read(g_pw.data_fd, &value, sizeof(value));
+    }
+}
+
+static void pipewire_stop(void) {
+    pw_thread_loop_lock(g_pw.loop);
+    pw_stream_set_active(g_pw.stream, false);
+    if (g_pw.pending) pw_stream_queue_buffer(g_pw.stream, g_pw.pending);
+    g_pw.pending = NULL;
+    g_pw.offset = 0;
+    pw_stream_flush(g_pw.stream, false);
+    pw_thread_loop_unlock(g_pw.loop);
+    uint64_t value;
+    read(g_pw.data_fd, &value, sizeof(value));
+}
+#endif
+
+// Tried in order unless CAPTURE_BACKEND names one
+static const CaptureSource g_capture_sources[] = {
+#ifdef HAVE_PIPEWIRE
+    { "pipewire", pipewire_open, pipewire_start, pipewire_read, pipewire_read_nowait, pipewire_stop, pipewire_close },
+#endif
+    { "alsa", alsa_open, alsa_start, alsa_read, alsa_read_nowait, alsa_stop, alsa_close },
+};
+
+static int capture_open(void) {
+    int err = 0;
+    for (size_t i = 0; i < sizeof(g_capture_sources) / sizeof(g_capture_sources[0]); i++) {
+        const CaptureSource *source = &g_capture_sources[i];
+        if (g_capture_backend && strcasecmp(g_capture_backend, source->name) != 0) continue;
+        if ((err = source->open()) == 0) {
+            g_capture = source;
+            return 0;
+        }
+    }
+    if (err == 0) {
+        fprintf(stderr, "Capture backend '%s' not available\n", g_capture_backend);
+        err = -ENODEV;
+    }
+    return err;
+}
+
+static void capture_close(void) {
+    if (g_capture) g_capture->close();
+    g_capture = NULL;
+}
+
+// Pass new encoder output on to the streaming upload
+static void forward_encoded(Session *s) {
+    Encoder *enc = s->encoder;
+    if (s->stream.active && enc->out.size > enc->streamed) {
+        stream_queue_push(&s->stream.queue, (char *)enc->out.data + enc->streamed, enc->out.size - enc->streamed);
+    }
+    enc->streamed = enc->out.size;
+}
+
+// Pass audio that made it through the VAD on to the capturing session: buffer,
+// encoder, stream, segmenter
+static void session_emit(const short *pcm, size_t frames) {
+    Session *s = g_session;
+    audio_store_append(&s->audio, pcm, frames * 2);
+    if (s->encoder) {
+        s->encoder->type->encode(s->encoder, pcm, frames);
+        forward_encoded(s);
+    } else if (s->stream.active) {
+        stream_queue_push(&s->stream.queue, pcm, frames * 2);
+    }
+
+    if (s->segments.active) {
+        segment_pipeline_feed(&s->segments, frames, g_dsp->peak(pcm, frames) / 32768.0f);
+    }
+}
+
+// VAD functions
+static void vad_reset(Vad *v) {
+    memset(v, 0, sizeof(*v));
+    v->noise_floor = -1.0f;
+}
+
+static void vad_flush(Vad *v) {
+    if (v->out_count > 0) session_emit(v->out, v->out_count);
+    v->out_count = 0;
+}
+
+static void vad_keep(Vad *v, const short *frame) {
+    if (v->out_count + VAD_FRAME > BUFFER_SIZE) vad_flush(v);
+    memcpy(v->out + v->out_count, frame, VAD_FRAME * sizeof(short));
+    v->out_count += VAD_FRAME;
+}
+
+static int vad_is_speech(Vad *v, const short *frame) {
+    float energy = (float)g_dsp->sum_squares(frame, VAD_FRAME) / VAD_FRAME;
+    int crossings = 0;
+    for (int i = 1; i < VAD_FRAME; i++) {
+        crossings += (frame[i] ^ frame[i - 1]) < 0;
+    }
+    float zcr = (float)crossings / VAD_FRAME;
+
+    if (v->noise_floor < 0.0f) v->noise_floor = energy;
+    float threshold = v->noise_floor * powf(10.0f, g_vad_threshold_db / 10.0f);
+    if (threshold < VAD_MIN_RMS * VAD_MIN_RMS) threshold = VAD_MIN_RMS * VAD_MIN_RMS;
+
+    // Voiced speech is loud; fricatives are quieter but cross zero often
+    int speech = energy > threshold ||
+                 (energy > threshold * 0.25f && zcr > 0.25f);
+
+    // Follow the background down at once, up slowly, and only outside speech
+    if (energy < v->noise_floor) v->noise_floor = energy;
+    else if (!speech) v->noise_floor = v->noise_floor * 0.98f + energy * 0.02f;
+    return speech;
+}
+
+static void vad_frame(Vad *v, const short *frame) {
+    if (vad_is_speech(v, frame)) {
+        v->speech_frames++;
+        v->silence_run = 0;
+        if (!v->emitting) {
+            // Onset: put back the silence just before it, oldest first
+            size_t start = (v->pad_head + VAD_PAD_FRAMES - v->pad_count) % VAD_PAD_FRAMES;
+            for (size_t i = 0; i < v->pad_count; i++) {
+                vad_keep(v, v->pad[(start + i) % VAD_PAD_FRAMES]);
+            }
+            v->pad_count = 0;
+            v->emitting = 1;
+        }
+        vad_keep(v, frame);
+        return;
+    }
+
+    v->silence_run++;
+    if (v->emitting && v->silence_run * 20 <= g_vad_max_silence_ms) {
+        vad_keep(v, frame); // a normal pause between words
+        return;
+    }
+    v->emitting = 0;
+    memcpy(v->pad[v->pad_head], frame, sizeof(v->pad[0]));
+    v->pad_head = (v->pad_head + 1) % VAD_PAD_FRAMES;
+    if (v->pad_count < VAD_PAD_FRAMES) v->pad_count++;
+}
+
+static void vad_process(Vad *v, const short *pcm, size_t frames) {
+    while (frames > 0) {
+        size_t n = VAD_FRAME - v->frame_fill;
+        if (n > frames) n = frames;
+        memcpy(v->frame + v->frame_fill, pcm, n * sizeof(short));
+        v->frame_fill += n;
+        pcm += n;
+        frames -= n;
+        if (v->frame_fill == VAD_FRAME) {
+            vad_frame(v, v->frame);
+            v->frame_fill = 0;
+        }
+    }
+    vad_flush(v);
+}
+
+// End of recording: keep the partial last frame if we were inside speech
+static void vad_finish(Vad *v) {
+    if (v->emitting && v->frame_fill > 0) {
+        if (v->out_count + v->frame_fill > BUFFER_SIZE) vad_flush(v);
+        memcpy(v->out + v->out_count, v->frame, v->frame_fill * sizeof(short));
+        v->out_count += v->frame_fill;
+    }
+    v->frame_fill = 0;
+    vad_flush(v);
+}
+
+// Hand one captured period to the session: gain, level meter, then the VAD gate
+static void capture_period(short *buffer, int frames) {
+    if (g_input_gain_q12 != 4096) g_dsp->gain(buffer, frames, g_input_gain_q12);
+
+    // Calculate current audio level
+    status_push_level(g_dsp->peak(buffer, frames) / 32768.0f);
+
+    if (g_vad_enabled) {
+        vad_process(&g_vad, buffer, frames);
+    } else {
+        session_emit(buffer, frames);
+    }
+}
+
+// Capture ring functions. Only the producer moves head and only the consumer moves tail.
+static void capture_ring_reset(CaptureRing *r) {
+    atomic_store(&r->head, 0);
+    atomic_store(&r->tail, 0);
+    atomic_store(&r->closed, 0);
+    atomic_store(&r->dropped, 0);
+}
+
+static void capture_ring_wake(CaptureRing *r) {
+    if (r->wake_fd >= 0) {
+        uint64_t one = 1;
+        write(r->wake_fd, &one, sizeof(one));
+    }
+}
+
+// Producer: the slot the next period should be read into, or NULL while the ring
+// is full. Reading straight into it saves a copy per period.
+static short *capture_ring_claim(CaptureRing *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= CAPTURE_RING_SLOTS) return NULL;
+    return r->slots[head % CAPTURE_RING_SLOTS];
+}
+
+// Producer: publish frames read into the claimed slot; without a slot they are dropped
+static void capture_ring_commit(CaptureRing *r, const short *slot, size_t frames) {
+    if (frames == 0) return;
+    if (!slot) {
+        atomic_fetch_add_explicit(&r->dropped, frames, memory_order_relaxed);
+        return;
+    }
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->frames[head % CAPTURE_RING_SLOTS] = frames;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    capture_ring_wake(r);
+}
+
+// Producer: copy a period in; never blocks
+static void capture_ring_push(CaptureRing *r, const short *pcm, size_t frames) {
+    while (frames > 0) {
+        size_t n = frames < BUFFER_SIZE ? frames : BUFFER_SIZE;
+        short *slot = capture_ring_claim(r);
+        if (slot) memcpy(slot, pcm, n * sizeof(short));
+        capture_ring_commit(r, slot, n);
+        pcm += n;
+        frames -= n;
+    }
+}
+
+static void capture_ring_close(CaptureRing *r) {
+    atomic_store_explicit(&r->closed, 1, memory_order_release);
+    capture_ring_wake(r);
+}
+
+// Consumer: process periods as they arrive until the producer closes the ring
+static void capture_ring_drain(CaptureRing *r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    for (;;) {
+        // closed before head: everything published ahead of the close is seen
+        int closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+        size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail == head) {
+            if (closed) break;
+            struct pollfd pfd = { .fd = r->wake_fd, .events = POLLIN };
+            if (poll(&pfd, 1, CAPTURE_POLL_TIMEOUT_MS) > 0) {
+                uint64_t value;
+                read(r->wake_fd, &value, sizeof(value));
+            }
+            continue;
+        }
+        if (!g_session->timing.first_frame) g_session->timing.first_frame = monotonic_ms();
+        for (; tail != head; tail++) {
+            size_t slot = tail % CAPTURE_RING_SLOTS;
+            capture_period(r->slots[slot], r->frames[slot]);
+            atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+        }
+    }
+
+    uint64_t dropped = atomic_load(&r->dropped);
+    if (dropped > 0) {
+        fprintf(stderr, "Processing fell behind: dropped %llu ms of audio\n",
+                (unsigned long long)(dropped * 1000 / SAMPLE_RATE));
+    }
+}
+
+// Daemon capture thread: always reading, feeding the pre-roll ring, and handing
+// periods to a session while one is attached
+static void *preroll_capture_thread(void *arg) {
+    (void)arg;
+    short scratch[BUFFER_SIZE];
+    short *preroll = malloc(g_preroll.capacity * sizeof(short)); // allocated once, not per session
+    uint64_t detached_at = 0; // ring position where the last session ended
+
+    while (!g_daemon_quit) {
+        int attached = atomic_load(&g_capture_attached);
+        if (attached == 1) {
+            // Session just started: its audio begins with the pre-roll, minus whatever
+            // the previous session already recorded
+            if (preroll) {
+                capture_ring_push(&g_capture_ring, preroll, preroll_snapshot(&g_preroll, preroll, detached_at));
+            }
+            atomic_store(&g_capture_attached, attached = 2);
+        }
+
+        // While a session is attached, read straight into its ring
+        short *slot = attached == 2 ? capture_ring_claim(&g_capture_ring) : NULL;
+        short *buffer = slot ? slot : scratch;
+        int frames = g_capture->read(buffer, CAPTURE_POLL_TIMEOUT_MS);
+        if (frames < 0) {
+            fprintf(stderr, "Capture failed: %s\n", snd_strerror(frames));
+            usleep(100000); // don't spin on a device that went away
+        }
+
+        if (frames > 0) {
+            preroll_write(&g_preroll, buffer, frames);
+            if (attached == 2) capture_ring_commit(&g_capture_ring, slot, frames);
+        }
+
+        if (attached == 2 && (g_stop_recording ||
+                              record_elapsed_ms() > g_max_recording_time * 1000ULL)) {
+            if (!g_stop_recording) update_status(STATUS_MAX_TIME, NULL);
+            detached_at = atomic_load_explicit(&g_preroll.written, memory_order_relaxed);
+            atomic_store(&g_capture_attached, 0);
+            capture_ring_close(&g_capture_ring);
+        }
+    }
+
+    // Release a session still waiting on us
+    if (atomic_exchange(&g_capture_attached, 0)) capture_ring_close(&g_capture_ring);
+    free(preroll);
+    return NULL;
+}
+
+static void start_preroll_capture(void) {
+    if (g_preroll_running || g_preroll_ms <= 0 || !g_capture) return;
+
+    g_preroll.capacity = (size_t)SAMPLE_RATE * g_preroll_ms / 1000;
+    g_preroll.samples = calloc(g_preroll.capacity, sizeof(short));
+    if (!g_preroll.samples) return;
+    atomic_store(&g_preroll.written, 0);
+
+    g_capture->start();
+    g_preroll_running = pthread_create(&g_preroll_thread, NULL, preroll_capture_thread, NULL) == 0;
+    if (!g_preroll_running) {
+        free(g_preroll.samples);
+        g_preroll.samples = NULL;
+    }
+}
+
+static uint64_t thread_cpu_us(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) return 0;
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// Session capture thread: nothing but reading the device into the ring
+static void *capture_thread(void *arg) {
+    (void)arg;
+    short scratch[BUFFER_SIZE]; // a full ring's periods land here and are counted as dropped
+    short *slot;
+    int frames;
+
+    g_capture->start();
+    while (!g_stop_recording) {
+        // Check timeout
+        if (record_elapsed_ms() > g_max_recording_time * 1000ULL) {
+            update_status(STATUS_MAX_TIME, NULL);
+            break;
+        }
+
+        slot = capture_ring_claim(&g_capture_ring);
+        frames = g_capture->read(slot ? slot : scratch, CAPTURE_POLL_TIMEOUT_MS);
+        if (frames < 0) {
+            fprintf(stderr, "Capture failed: %s\n", snd_strerror(frames));
+            update_status(STATUS_ERROR, "Audio device failed");
+            break;
+        }
+        capture_ring_commit(&g_capture_ring, slot, frames);
+    }
+
+    // Keep whatever arrived between the last wakeup and the stop request
+    for (;;) {
+        slot = capture_ring_claim(&g_capture_ring);
+        if ((frames = g_capture->read_nowait(slot ? slot : scratch)) < 0) break;
+        capture_ring_commit(&g_capture_ring, slot, frames);
+    }
+    g_session->timing.capture_cpu_us = thread_cpu_us();
+    capture_ring_close(&g_capture_ring);
+    return NULL;
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Load a fixture for --replay: 16- or 32-bit PCM at any rate, converted to the
+// pipeline format by the same converter a native-rate device goes through
+static int replay_load(const char *path, ReplaySource *src) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char riff[12], chunk[8], fmt[16];
+    int ok = fread(riff, 1, sizeof(riff), fp) == sizeof(riff) &&
+             memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0;
+    int format_ok = 0;
+    unsigned rate = 0, channels = 0, bits = 0;
+    uint32_t size = 0;
+    while (ok && (ok = fread(chunk, 1, sizeof(chunk), fp) == sizeof(chunk))) {
+        size = read_le32(chunk + 4);
+        if (memcmp(chunk, "data", 4) == 0) break;
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(fmt) && fread(fmt, 1, sizeof(fmt), fp) == sizeof(fmt)) {
+            unsigned tag = fmt[0] | fmt[1] << 8;
+            channels = fmt[2] | fmt[3] << 8;
+            bits = fmt[14] | fmt[15] << 8;
+            rate = read_le32(fmt + 4);
+            format_ok = (tag == 1 || tag == 0xFFFE) && channels >= 1 && channels <= CAPTURE_MAX_CHANNELS &&
+                        (bits == 16 || bits == 32) && rate > 0;
+            size -= sizeof(fmt);
+        }
+        fseek(fp, size + (size & 1), SEEK_CUR);
+    }
+    if (!ok || !format_ok) {
+        fprintf(stderr, "%s: need a 16- or 32-bit PCM WAV\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    // Streamed WAVs (like the ones this tool uploads) carry a placeholder data size
+    long start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    long end = ftell(fp);
+    fseek(fp, start, SEEK_SET);
+    if ((long)size > end - start) size = end - start;
+
+    CaptureConverter conv = { .passthrough = 1 };
+    size_t frame_bytes = channels * bits / 8, in_frames = size / frame_bytes;
+    if (converter_init(&conv, rate, channels, bits / 8) < 0) {
+        fclose(fp);
+        return -1;
+    }
+    size_t capacity = conv.passthrough ? in_frames : in_frames * conv.up / conv.down + 2;
+    src->pcm = malloc((capacity ? capacity : 1) * sizeof(short));
+    src->frames = 0;
+    if (src->pcm && conv.passthrough) {
+        src->frames = fread(src->pcm, sizeof(short), in_frames, fp);
+    } else if (src->pcm) {
+        size_t n;
+        while ((n = fread(conv.raw, frame_bytes, conv.max_read, fp)) > 0) {
+            src->frames += converter_run(&conv, n, src->pcm + src->frames);
+        }
+    }
+    converter_free(&conv);
+    fclose(fp);
+    return src->pcm ? 0 : -1;
+}
+
+// --replay producer: the fixture's periods instead of snd_pcm_readi, at real-time
+// pace or as fast as the processing thread takes them
+static void *replay_thread(void *arg) {
+    ReplaySource *src = (ReplaySource *)arg;
+    size_t limit = (size_t)g_max_recording_time * SAMPLE_RATE;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (size_t off = 0, n; off < src->frames && !g_stop_recording; off += n) {
+        if (off >= limit) {
+            update_status(STATUS_MAX_TIME, NULL);
+            break;
+        }
+        n = src->frames - off < (size_t)g_period_frames ? src->frames - off : (size_t)g_period_frames;
+        if (src->realtime) {
+            uint64_t ns = next.tv_nsec + (uint64_t)n * 1000000000 / SAMPLE_RATE;
+            next.tv_sec += ns / 1000000000;
+            next.tv_nsec = ns % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        } else {
+            // Unlike a device, a file can wait: never drop periods at full speed
+            while (atomic_load(&g_capture_ring.head) - atomic_load(&g_capture_ring.tail) >= CAPTURE_RING_SLOTS) {
+                usleep(1000);
+            }
+        }
+        capture_ring_push(&g_capture_ring, src->pcm + off, n);
+    }
+
+    request_stop(); // the end of the fixture is the second hotkey press
+    g_session->timing.capture_cpu_us = thread_cpu_us();
+    capture_ring_close(&g_capture_ring);
+    return NULL;
+}
+
+// Recording thread: processes the session's audio while a capture thread reads it.
+// A source the daemon already holds open is borrowed; otherwise the session opens
+// one for itself and closes it afterwards.
+static void *recording_thread(void *arg) {
+    (void)arg;
+    int owned = g_capture == NULL;
+
+    // Size the store for the longest recording (plus pre-roll) BEFORE any delays;
+    // blocks are added as audio arrives, so nothing is ever copied to grow it
+    if (audio_store_init(&g_session->audio,
+                         ((size_t)g_max_recording_time * 1000 + g_preroll_ms + 2000) * SAMPLE_RATE / 1000 * 2) < 0) {
+        update_status(STATUS_ERROR, "Out of memory");
+        return NULL;
+    }
+    capture_ring_reset(&g_capture_ring);
+
+    if (!owned && g_preroll_running) {
+        // The daemon is already capturing: attach and process until it lets go
+        update_status(STATUS_RECORDING, NULL);
+        g_session->timing.device_open = monotonic_ms();
+        atomic_store(&g_capture_attached, 1);
+        capture_ring_drain(&g_capture_ring);
+        return NULL;
+    }
+
+    int replay = g_replay.pcm != NULL;
+    if (owned && !replay && capture_open() < 0) {
+        update_status(STATUS_ERROR, "Audio device failed");
+        return NULL;
+    }
+    g_session->timing.device_open = monotonic_ms();
+
+    update_status(STATUS_RECORDING, NULL);
+
+    // Start recording immediately
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, replay ? replay_thread : capture_thread,
+                       replay ? (void *)&g_replay : NULL) == 0) {
+        capture_ring_drain(&g_capture_ring);
+        pthread_join(reader, NULL);
+    } else {
+        update_status(STATUS_ERROR, "Audio device failed");
+    }
+    g_session->timing.process_cpu_us = thread_cpu_us();
+
+    if (replay) {
+        // no device to release
+    } else if (owned) {
+        capture_close();
+    } else {
+        // Keep the daemon's source ready for the next session
+        g_capture->stop();
+    }
+    return NULL;
+}
+
+// Connection reuse: every handle shares DNS, TLS sessions and live connections, so
+// an upload rides on whatever connection the warm-up or a previous request left open
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp) {
+    (void)handle;
+    (void)access;
+    (void)userp;
+    pthread_mutex_lock(&g_share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userp) {
+    (void)handle;
+    (void)userp;
+    pthread_mutex_unlock(&g_share_locks[data]);
+}
+
+static void init_connection_share(void) {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&g_share_locks[i], NULL);
+    }
+    g_share = curl_share_init();
+    if (!g_share) return;
+    curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+static void configure_transport(CURL *curl) {
+    if (g_share) curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);      // prefer multiplexing over a new connection
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)CONNECT_TIMEOUT_MS);
+}
+
+// Pre-connect: a body-less request that leaves a TLS connection in the shared cache
+static void *warmup_thread(void *arg) {
+    (void)arg;
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+    configure_transport(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, g_api_url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 10000L);
+    curl_easy_perform(curl); // the status code doesn't matter, only the connection
+    curl_easy_cleanup(curl);
+    return NULL;
+}
+
+static void start_warmup(Session *s) {
+    if (!g_preconnect || s->warmup_running) return;
+    s->warmup_running = pthread_create(&s->warmup_thread, NULL, warmup_thread, NULL) == 0;
+}
+
+static void finish_warmup(Session *s) {
+    if (!s->warmup_running) return;
+    pthread_join(s->warmup_thread, NULL);
+    s->warmup_running = 0;
+}
+
+// Streaming upload: curl pulls the WAV header, then PCM periods as they are recorded
+static size_t stream_read_callback(char *dest, size_t size, size_t nmemb, void *userp) {
+    StreamUpload *up = (StreamUpload *)userp;
+    StreamQueue *q = &up->queue;
+    size_t room = size * nmemb;
+
+    if (up->header_sent < up->header_size) {
+        size_t n = up->header_size - up->header_sent;
+        if (n > room) n = room;
+        memcpy(dest, (const char *)&up->header + up->header_sent, n);
+        up->header_sent += n;
+        return n;
+    }
+
+    // Never block inside curl: pause until the producer wakes the upload thread
+    pthread_mutex_lock(&q->lock);
+    if (q->count == 0 && !q->closed && !q->overflow) {
+        q->paused = 1;
+        pthread_mutex_unlock(&q->lock);
+        return CURL_READFUNC_PAUSE;
+    }
+    if (q->overflow) {
+        pthread_mutex_unlock(&q->lock);
+        return CURL_READFUNC_ABORT;
+    }
+
+    size_t copied = 0;
+    while (q->count > 0 && copied < room) {
+        size_t slot_bytes = q->bytes[q->head];
+        size_t n = slot_bytes - q->read_offset;
+        if (n > room - copied) n = room - copied;
+        memcpy(dest + copied, (const char *)q->data[q->head] + q->read_offset, n);
+        copied += n;
+        q->read_offset += n;
+        if (q->read_offset == slot_bytes) {
+            q->read_offset = 0;
+            q->head = (q->head + 1) % STREAM_QUEUE_SLOTS;
+            q->count--;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    atomic_fetch_add_explicit(&up->session->timing.uploaded, copied, memory_order_relaxed);
+    return copied; // 0 only once the queue is closed and drained
+}
+
+static size_t mem_read_callback(char *dest, size_t size, size_t nmemb, void *userp) {
+    MemReader *r = (MemReader *)userp;
+    size_t room = size * nmemb;
+    size_t copied = 0;
+
+    if (r->offset < r->head_size) {
+        copied = r->head_size - r->offset;
+        if (copied > room) copied = room;
+        memcpy(dest, r->head + r->offset, copied);
+        r->offset += copied;
+    }
+
+    size_t pos = r->offset - r->head_size;
+    if (r->offset >= r->head_size && pos < r->size && copied < room) {
+        size_t n = r->size - pos;
+        if (n > room - copied) n = room - copied;
+        if (r->store) audio_store_copy(r->store, r->store_offset + pos, dest + copied, n);
+        else memcpy(dest + copied, r->data + pos, n);
+        r->offset += n;
+        copied += n;
+    }
+    if (r->uploaded) atomic_fetch_add_explicit(r->uploaded, copied, memory_order_relaxed);
+    return copied;
+}
+
+static int mem_seek_callback(void *userp, curl_off_t offset, int origin) {
+    MemReader *r = (MemReader *)userp;
+    if (origin != SEEK_SET || offset < 0 || (size_t)offset > r->head_size + r->size) return CURL_SEEKFUNC_CANTSEEK;
+    r->offset = offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+// Build a transcription POST whose file part is produced by read_cb (size -1: chunked).
+// curl is a handle to reuse (the daemon's warm one) or NULL for a fresh one.
+static int request_init(TranscribeRequest *req, CURL *curl, const EncoderType *format, curl_read_callback read_cb,
+                        curl_seek_callback seek_cb, curl_off_t size, void *arg) {
+    memset(req, 0, sizeof(*req));
+    req->curl = curl ? curl : curl_easy_init();
+    response_init(&req->response, req->curl);
+    if (!req->curl) return -1;
+
+    req->mime = curl_mime_init(req->curl);
+    curl_mimepart *part = curl_mime_addpart(req->mime);
+    curl_mime_name(part, "file");
+    curl_mime_filename(part, format->filename);
+    curl_mime_type(part, format->mime_type);
+    curl_mime_data_cb(part, size, read_cb, seek_cb, NULL, arg);
+
+    part = curl_mime_addpart(req->mime);
+    curl_mime_name(part, "model");
+    curl_mime_data(part, g_api_model, CURL_ZERO_TERMINATED);
+
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", g_api_key);
+    req->headers = curl_slist_append(req->headers, auth_header);
+    req->headers = curl_slist_append(req->headers, "Expect:"); // don't wait for 100-continue
+
+    configure_transport(req->curl);
+
+    // A stalled connection fails instead of leaving the overlay at UPLOADING forever,
+    // and the deadline grows with the upload. A streamed body legitimately idles
+    // through long pauses, so stream_upload_thread() times it from the end instead.
+    if (size >= 0) {
+        curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_TIME, (long)STALL_TIMEOUT_S);
+        curl_easy_setopt(req->curl, CURLOPT_TIMEOUT_MS,
+                         (long)(REQUEST_BASE_TIMEOUT_MS + size * 1000 / UPLOAD_FLOOR_BYTES_PER_S));
+    }
+
+    curl_easy_setopt(req->curl, CURLOPT_URL, g_api_url);
+    curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+    curl_easy_setopt(req->curl, CURLOPT_MIMEPOST, req->mime);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, &req->response);
+    return 0;
+}
+
+static void request_cleanup(TranscribeRequest *req) {
+    curl_mime_free(req->mime);
+    curl_slist_free_all(req->headers);
+    if (req->curl == g_curl) {
+        curl_easy_reset(req->curl); // keeps the connection cache for next time
+    } else if (req->curl) {
+        curl_easy_cleanup(req->curl);
+    }
+    response_free(&req->response);
+    memset(req, 0, sizeof(*req));
+}
+
+// Read a finished transfer's phase times; curl reports them in microseconds from its start
+static void transfer_times(CURL *curl, TransferTimes *t) {
+    curl_off_t connect = 0, tls = 0, first_byte = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    t->start_ms = monotonic_ms() - total / 1000;
+    t->connect = connect / 1000;
+    t->tls = tls / 1000;
+    t->first_byte = first_byte / 1000;
+    t->last_byte = total / 1000;
+}
+
+// Judge a finished transcription request: 0 with *result set, 1 worth retrying
+// (transport error, 429 or 5xx), -1 permanent; *retry_after_ms is the server's hint
+static int request_outcome(TranscribeRequest *req, CURLcode res, char **result, long *retry_after_ms) {
+    long code = 0;
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (res != CURLE_OK) {
+        fprintf(stderr, "CURL error: %s\n", curl_easy_strerror(res));
+        return 1;
+    }
+    if (code == 429 || code >= 500) {
+        curl_off_t retry_after = 0;
+        if (curl_easy_getinfo(req->curl, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK && retry_after > 0) {
+            *retry_after_ms = (long)retry_after * 1000;
+        }
+        fprintf(stderr, "Transcription request failed with HTTP %ld\n", code);
+        return 1;
+    }
+    if (code != 200) {
+        const CurlResponse *resp = &req->response;
+        fprintf(stderr, "Transcription request rejected with HTTP %ld: %s\n", code,
+                resp->error_message >= 0 ? resp->arena + resp->error_message : "no details");
+        return -1;
+    }
+    return response_text(&req->response, result) == 0 ? 0 : -1;
+}
+
+// One attempt, optionally hedged: if no answer arrived after g_hedge_after_ms a second
+// identical request races the first and whichever succeeds first wins
+static int transcribe_attempt(CURL *curl, const MemReader *source, const EncoderType *format, char **result,
+                              long *retry_after_ms, TransferTimes *times) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) return 1;
+
+    TranscribeRequest reqs[2];
+    MemReader readers[2];
+    int started = 0, finished = 0, outcome = 1;
+    int hedge_ms = g_hedge_after_ms;
+    uint64_t start_ms = monotonic_ms();
+
+    for (;;) {
+        if (started == 0 || (started == 1 && hedge_ms > 0 && monotonic_ms() - start_ms >= (uint64_t)hedge_ms)) {
+            // The first request reuses the caller's handle; a hedge gets its own handle and
+            // connection, in case the first one is stuck on a bad path
+            readers[started] = *source;
+            if (request_init(&reqs[started], started == 0 ? curl : NULL, format, mem_read_callback,
+                             mem_seek_callback, source->head_size + source->size, &readers[started]) != 0) {
+                request_cleanup(&reqs[started]);
+                if (started == 0) break;
+                hedge_ms = 0;
+            } else {
+                if (started == 1) curl_easy_setopt(reqs[1].curl, CURLOPT_FRESH_CONNECT, 1L);
+                curl_multi_add_handle(multi, reqs[started].curl);
+                started++;
+            }
+        }
+
+        int running;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int left;
+        while (outcome != 0 && (msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            TranscribeRequest *req = msg->easy_handle == reqs[0].curl ? &reqs[0] : &reqs[1];
+            int r = request_outcome(req, msg->data.result, result, retry_after_ms);
+            if (r == 0 && times) transfer_times(req->curl, times);
+            // Keep the more hopeful verdict when both requests fail
+            if (r == 0 || finished == 0 || r > outcome) outcome = r;
+            finished++;
+        }
+        if (outcome == 0 || finished == started) break;
+
+        int wait_ms = 1000;
+        if (started == 1 && hedge_ms > 0) {
+            int64_t until_hedge = (int64_t)start_ms + hedge_ms - (int64_t)monotonic_ms();
+            wait_ms = until_hedge <= 0 ? 0 : until_hedge < wait_ms ? (int)until_hedge : wait_ms;
+        }
+        curl_multi_poll(multi, NULL, 0, wait_ms, NULL);
+    }
+
+    // Dropping the loser aborts its transfer
+    for (int i = 0; i < started; i++) {
+        curl_multi_remove_handle(multi, reqs[i].curl);
+        request_cleanup(&reqs[i]);
+    }
+    curl_multi_cleanup(multi);
+    return outcome;
+}
+
+// Wait before the next attempt: exponential backoff with jitter, or the server's
+// Retry-After hint when that is longer (within reason)
+static long retry_delay_ms(int attempt, long retry_after_ms) {
+    long delay_ms = RETRY_BASE_MS << attempt;
+    if (delay_ms > RETRY_MAX_MS) delay_ms = RETRY_MAX_MS;
+    if (retry_after_ms > delay_ms) delay_ms = retry_after_ms < RETRY_MAX_MS * 4 ? retry_after_ms : RETRY_MAX_MS * 4;
+    return delay_ms + monotonic_ms() % 250; // jitter
+}
+
+// Transcribe audio straight from memory: raw PCM for WAV (the header is prepended
+// on the fly), or a complete encoded file for the other formats. Transient failures
+// are retried with exponential backoff, unless we already know we're offline.
+// Returns 0, 1 when it may work later, or -1. Phase times and body bytes go to timing.
+static int transcribe_reader(const MemReader *reader, const EncoderType *format, SessionTiming *timing,
+                             char **result) {
+    MemReader counted = *reader;
+    counted.uploaded = &timing->uploaded;
+    // The warm handle serves one session at a time; one overlapping it gets its own
+    CURL *curl = g_curl && pthread_mutex_trylock(&g_curl_lock) == 0 ? g_curl : NULL;
+    int retries = g_offline ? 0 : g_upload_retries;
+    for (int attempt = 0;; attempt++) {
+        long retry_after_ms = 0;
+        int outcome = transcribe_attempt(curl, &counted, format, result, &retry_after_ms, &timing->upload);
+        g_offline = outcome > 0;
+        if (outcome <= 0 || attempt >= retries) {
+            if (curl) pthread_mutex_unlock(&g_curl_lock);
+            return outcome;
+        }
+
+        long delay_ms = retry_delay_ms(attempt, retry_after_ms);
+        fprintf(stderr, "Retrying transcription in %ld ms (%d/%d)\n", delay_ms, attempt + 1, g_upload_retries);
+        usleep(delay_ms * 1000);
+    }
+}
+
+static int transcribe_audio(const void *audio_data, size_t audio_size, const EncoderType *format,
+                            SessionTiming *timing, char **result) {
+    WavHeader wav_header;
+    MemReader reader = { .data = audio_data, .size = audio_size };
+    if (!format->init) {
+        fill_wav_header(&wav_header, audio_size);
+        reader.head = (const char *)&wav_header;
+        reader.head_size = sizeof(wav_header);
+    }
+    return transcribe_reader(&reader, format, timing, result);
+}
+
+// Run the streamed request on the queue's multi handle. The read callback pauses
+// it whenever the queue runs dry; a push or close wakes the poll and it resumes.
+// Once the body is complete the answer gets the same deadline a buffered upload
+// of that size would.
+static CURLcode stream_perform(StreamUpload *up, CURL *curl) {
+    StreamQueue *q = &up->queue;
+    if (curl_multi_add_handle(q->multi, curl) != CURLM_OK) return CURLE_FAILED_INIT;
+    CURLcode res = CURLE_OPERATION_TIMEDOUT;
+    uint64_t deadline = 0;
+    for (;;) {
+        int running;
+        curl_multi_perform(q->multi, &running);
+        CURLMsg *msg;
+        int left, done = 0;
+        while ((msg = curl_multi_info_read(q->multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            res = msg->data.result;
+            done = 1;
+        }
+        if (done || !running) break;
+
+        pthread_mutex_lock(&q->lock);
+        int resume = q->paused && (q->count > 0 || q->closed);
+        if (resume) q->paused = 0;
+        int closed = q->closed;
+        pthread_mutex_unlock(&q->lock);
+        if (resume) {
+            curl_easy_pause(curl, CURLPAUSE_CONT);
+            continue;
+        }
+
+        if (closed && !deadline) {
+            uint64_t sent = atomic_load(&up->session->timing.uploaded);
+            deadline = monotonic_ms() + REQUEST_BASE_TIMEOUT_MS + sent * 1000 / UPLOAD_FLOOR_BYTES_PER_S;
+        }
+        if (deadline && monotonic_ms() > deadline) {
+            fprintf(stderr, "Streaming upload timed out\n");
+            break;
+        }
+        curl_multi_poll(q->multi, NULL, 0, 1000, NULL);
+    }
+    curl_multi_remove_handle(q->multi, curl);
+    return res;
+}
+
+static void *stream_upload_thread(void *arg) {
+    StreamUpload *up = (StreamUpload *)arg;
+    TranscribeRequest req;
+
+    up->status = -1;
+    Session *s = up->session;
+    const EncoderType *format = s->encoder ? s->encoder->type : &g_encoder_types[0];
+    if (request_init(&req, NULL, format, stream_read_callback, NULL, -1, up) == 0) {
+        // Not retried: a failed stream falls back to the buffered upload, which is
+        long retry_after_ms = 0;
+        CURLcode res = stream_perform(up, req.curl);
+        if (request_outcome(&req, res, &up->result, &retry_after_ms) == 0) {
+            up->status = 0;
+            transfer_times(req.curl, &s->timing.upload);
+        } else {
+            fprintf(stderr, "Streaming upload failed\n");
+        }
+    }
+    request_cleanup(&req);
+
+    // Unblock the recording side if we bailed out early
+    stream_queue_close(&up->queue, 1);
+    return NULL;
+}
+
+static void start_stream_upload(Session *s) {
+    StreamUpload *up = &s->stream;
+    StreamQueue *q = &up->queue;
+    q->head = q->tail = q->count = q->read_offset = 0;
+    q->closed = q->overflow = q->paused = 0;
+    q->multi = curl_multi_init();
+    if (!q->multi) return;
+    fill_wav_header(&up->header, WAV_STREAMING_SIZE);
+    up->session = s;
+    up->header_size = s->encoder ? 0 : sizeof(WavHeader);
+    up->header_sent = 0;
+    up->status = -1;
+    up->result = NULL;
+    up->active = 1;
+    if (pthread_create(&up->thread, NULL, stream_upload_thread, up) != 0) {
+        up->active = 0;
+        curl_multi_cleanup(q->multi);
+        q->multi = NULL;
+    }
+}
+
+// Close the stream and wait for the server's answer; cancel aborts the request instead
+static int finish_stream_upload(Session *s, int cancel, char **result) {
+    StreamUpload *up = &s->stream;
+    if (!up->active) return -1;
+    stream_queue_close(&up->queue, cancel);
+    pthread_join(up->thread, NULL);
+    up->active = 0;
+    curl_multi_cleanup(up->queue.multi);
+    up->queue.multi = NULL;
+    if (up->status == 0 && !cancel) {
+        *result = up->result;
+        return 0;
+    }
+    free(up->result);
+    up->result = NULL;
+    return -1;
+}
+
+// Segment pipeline: long recordings are cut at pauses and transcribed concurrently
+static void segment_close(SegmentPipeline *sp, size_t end_offset) {
+    size_t pcm_size = end_offset - sp->cut_offset;
+    if (pcm_size == 0) return;
+
+    Segment *seg = calloc(1, sizeof(Segment));
+    if (!seg) return;
+    seg->pcm_offset = sp->cut_offset;
+    seg->pcm_size = pcm_size;
+    sp->cut_offset = end_offset;
+
+    pthread_mutex_lock(&sp->lock);
+    if (sp->count == sp->capacity) {
+        size_t new_capacity = sp->capacity ? sp->capacity * 2 : 16;
+        Segment **items = realloc(sp->items, new_capacity * sizeof(Segment *));
+        if (!items) {
+            pthread_mutex_unlock(&sp->lock);
+            free(seg);
+            return;
+        }
+        sp->items = items;
+        sp->capacity = new_capacity;
+    }
+    sp->items[sp->count++] = seg;
+    pthread_mutex_unlock(&sp->lock);
+
+    curl_multi_wakeup(sp->multi);
+}
+
+// Called by the recording thread after each period has been appended
+static void segment_pipeline_feed(SegmentPipeline *sp, int frames, float level) {
+    size_t target = (size_t)g_segment_seconds * SAMPLE_RATE * 2;
+    size_t length = sp->session->audio.size - sp->cut_offset;
+
+    if (level < SEGMENT_SILENCE_LEVEL) {
+        sp->quiet_frames += frames;
+    } else {
+        sp->quiet_frames = 0;
+    }
+
+    // Cut in a pause once past the target, or unconditionally well beyond it
+    if ((length >= target && sp->quiet_frames >= SAMPLE_RATE * SEGMENT_MIN_SILENCE_MS / 1000) ||
+        length >= target + target / 2) {
+        segment_close(sp, sp->session->audio.size);
+        sp->quiet_frames = 0;
+    }
+}
+
+// Compress a closed segment on the worker thread, off the capture path
+static void segment_encode(SegmentPipeline *sp, Segment *seg) {
+    seg->format = &g_encoder_types[0];
+    Encoder *enc = encoder_new(g_upload_format);
+    if (!enc) return;
+
+    if (audio_store_encode(enc, &sp->session->audio, seg->pcm_offset, seg->pcm_size) == 0 && enc->type->finish(enc) == 0) {
+        seg->body = enc->out.data;
+        seg->size = enc->out.size;
+        seg->format = enc->type;
+        enc->out.data = NULL;
+    }
+    encoder_free(enc);
+}
+
+// Join the texts of the first count segments, all transcribed, with single spaces
+static char *segment_join(SegmentPipeline *sp, size_t count) {
+    size_t total = 1;
+    for (size_t i = 0; i < count; i++) total += strlen(sp->items[i]->text) + 1;
+
+    char *text = malloc(total);
+    if (!text) return NULL;
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *t = sp->items[i]->text;
+        while (*t == ' ') t++;
+        size_t n = strlen(t);
+        if (n == 0) continue;
+        if (len > 0) text[len++] = ' ';
+        memcpy(text + len, t, n);
+        len += n;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+// Live mode: show the in-order prefix of finished segments in the overlay
+static void segment_publish_partial(SegmentPipeline *sp) {
+    pthread_mutex_lock(&sp->lock);
+    size_t ready = 0;
+    while (ready < sp->count && sp->items[ready]->status == 1) ready++;
+    char *text = ready > sp->published ? segment_join(sp, ready) : NULL;
+    if (text) sp->published = ready;
+    pthread_mutex_unlock(&sp->lock);
+
+    if (text) {
+        if (session_in_front(sp->session)) status_set_partial(text);
+        free(text);
+    }
+}
+
+// Encode one closed segment and hand its request to the multi handle; 0 once it is in flight
+static int segment_submit(SegmentPipeline *sp, Segment *seg) {
+    if (seg->attempts++ == 0) {
+        seg->retries = g_offline ? 0 : g_upload_retries;
+        segment_encode(sp, seg);
+    }
+    if (seg->body) {
+        seg->reader = (MemReader){ .data = seg->body, .size = seg->size };
+    } else {
+        fill_wav_header(&seg->wav, seg->pcm_size);
+        seg->reader = (MemReader){ .head = (const char *)&seg->wav, .head_size = sizeof(WavHeader),
+                                   .store = &sp->session->audio, .store_offset = seg->pcm_offset,
+                                   .size = seg->pcm_size };
+    }
+    seg->reader.uploaded = &sp->session->timing.uploaded;
+    if (request_init(&seg->req, NULL, seg->format, mem_read_callback, mem_seek_callback,
+                     seg->reader.head_size + seg->reader.size, &seg->reader) != 0) {
+        request_cleanup(&seg->req);
+        seg->status = -1;
+        return -1;
+    }
+    curl_easy_setopt(seg->req.curl, CURLOPT_PRIVATE, seg);
+    curl_multi_add_handle(sp->multi, seg->req.curl);
+    return 0;
+}
+
+static void *segment_worker_thread(void *arg) {
+    SegmentPipeline *sp = (SegmentPipeline *)arg;
+    int in_flight = 0, waiting = 0; // requests running, and segments backing off before a retry
+
+    for (;;) {
+        // Only take the next segment under the lock; encoding it and building the
+        // request happen outside, so cutting segments never waits for an encode.
+        // Retries that are due go before newly closed segments.
+        Segment *seg = NULL;
+        uint64_t now = monotonic_ms(), next_retry = 0;
+        pthread_mutex_lock(&sp->lock);
+        int cancelled = sp->cancelled;
+        for (size_t i = 0; !cancelled && waiting > 0 && i < sp->next_submit; i++) {
+            Segment *pending = sp->items[i];
+            if (!pending->retry_at_ms) continue;
+            if (!seg && in_flight < SEGMENT_WORKERS && pending->retry_at_ms <= now) seg = pending;
+            else if (!next_retry || pending->retry_at_ms < next_retry) next_retry = pending->retry_at_ms;
+        }
+        if (!cancelled && !seg && in_flight < SEGMENT_WORKERS && sp->next_submit < sp->count) {
+            seg = sp->items[sp->next_submit++];
+        }
+        int done = sp->closed && sp->next_submit == sp->count && in_flight == 0 && waiting == 0;
+        pthread_mutex_unlock(&sp->lock);
+        if (cancelled) break;
+        if (seg) {
+            if (seg->retry_at_ms) {
+                seg->retry_at_ms = 0;
+                waiting--;
+            }
+            if (segment_submit(sp, seg) == 0) in_flight++;
+            continue;
+        }
+        if (done) break;
+
+        int running;
+        curl_multi_perform(sp->multi, &running);
+
+        CURLMsg *msg;
+        int left, finished = 0;
+        while ((msg = curl_multi_info_read(sp->multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Segment *seg = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&seg);
+            long retry_after_ms = 0;
+            int outcome = request_outcome(&seg->req, msg->data.result, &seg->text, &retry_after_ms);
+            if (outcome == 0) transfer_times(msg->easy_handle, &sp->session->timing.upload);
+            curl_multi_remove_handle(sp->multi, msg->easy_handle);
+            request_cleanup(&seg->req);
+            in_flight--;
+            g_offline = outcome > 0;
+
+            // A transient failure retries just this segment, backing off like transcribe_reader()
+            if (outcome > 0 && seg->attempts <= seg->retries) {
+                long delay_ms = retry_delay_ms(seg->attempts - 1, retry_after_ms);
+                fprintf(stderr, "Retrying segment in %ld ms (%d/%d)\n", delay_ms, seg->attempts, seg->retries);
+                seg->retry_at_ms = monotonic_ms() + delay_ms;
+                if (!next_retry || seg->retry_at_ms < next_retry) next_retry = seg->retry_at_ms;
+                waiting++;
+                continue;
+            }
+            seg->status = outcome == 0 ? 1 : -1;
+            free(seg->body);
+            seg->body = NULL;
+            finished = 1;
+        }
+        if (finished && g_live_transcript) segment_publish_partial(sp);
+
+        // Woken early by curl_multi_wakeup() whenever a new segment closes
+        int wait_ms = 1000;
+        if (next_retry) {
+            now = monotonic_ms();
+            wait_ms = next_retry <= now ? 0 : next_retry - now < 1000 ? (int)(next_retry - now) : 1000;
+        }
+        curl_multi_poll(sp->multi, NULL, 0, wait_ms, NULL);
+    }
+
+    // Cancelled: drop the uploads still in flight and the retries still waiting
+    for (size_t i = 0; i < sp->next_submit; i++) {
+        Segment *seg = sp->items[i];
+        if (seg->status != 0) continue;
+        if (seg->req.curl) curl_multi_remove_handle(sp->multi, seg->req.curl);
+        request_cleanup(&seg->req);
+        seg->status = -1;
+    }
+    return NULL;
+}
+
+static void start_segment_pipeline(Session *s) {
+    SegmentPipeline *sp = &s->segments;
+    sp->session = s;
+    sp->cut_offset = 0;
+    sp->quiet_frames = 0;
+    sp->published = 0;
+    sp->closed = 0;
+    sp->cancelled = 0;
+    sp->multi = curl_multi_init();
+    if (!sp->multi) return;
+    curl_multi_setopt(sp->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    sp->active = 1;
+    if (pthread_create(&sp->thread, NULL, segment_worker_thread, sp) != 0) {
+        sp->active = 0;
+        curl_multi_cleanup(sp->multi);
+    }
+}
+
+// Close the tail segment, wait for all requests and join the texts in order; cancel
+// abandons the requests instead
+static int finish_segment_pipeline(Session *s, int cancel, char **result) {
+    SegmentPipeline *sp = &s->segments;
+    if (!sp->active) return -1;
+
+    if (!cancel) segment_close(sp, s->audio.size);
+    pthread_mutex_lock(&sp->lock);
+    sp->closed = 1;
+    sp->cancelled = cancel;
+    pthread_mutex_unlock(&sp->lock);
+    curl_multi_wakeup(sp->multi);
+    pthread_join(sp->thread, NULL);
+    curl_multi_cleanup(sp->multi);
+    sp->active = 0;
+
+    int ret = sp->count > 0 && !cancel ? 0 : -1;
+    for (size_t i = 0; i < sp->count; i++) {
+        if (sp->items[i]->status != 1) ret = -1;
+    }
+
+    char *text = ret == 0 ? segment_join(sp, sp->count) : NULL;
+    if (text) *result = text;
+    else ret = -1;
+
+    for (size_t i = 0; i < sp->count; i++) {
+        free(sp->items[i]->body);
+        free(sp->items[i]->text);
+        free(sp->items[i]);
+    }
+    free(sp->items);
+    sp->items = NULL;
+    sp->count = sp->capacity = sp->next_submit = 0;
+    return ret;
+}
+
+// Transcriber backends
+static int openai_transcribe(const AudioStore *audio, SessionTiming *timing, char **result) {
+    WavHeader wav_header;
+    fill_wav_header(&wav_header, audio->size);
+    MemReader reader = { .head = (const char *)&wav_header, .head_size = sizeof(wav_header),
+                         .store = audio, .size = audio->size };
+    return transcribe_reader(&reader, &g_encoder_types[0], timing, result);
+}
+
+#ifdef HAVE_WHISPER
+static struct whisper_context *g_whisper = NULL;
+
+static int whisper_load(void) {
+    if (g_whisper) return 0;
+    if (!g_whisper_model) {
+        fprintf(stderr, "BACKEND=whisper needs WHISPER_MODEL\n");
+        return -1;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = g_whisper_gpu;
+    g_whisper = whisper_init_from_file_with_params(g_whisper_model, cparams);
+    if (!g_whisper) {
+        fprintf(stderr, "Cannot load whisper model %s\n", g_whisper_model);
+        return -1;
+    }
+    return 0;
+}
+
+static int whisper_transcribe(const AudioStore *audio, SessionTiming *timing, char **result) {
+    (void)timing;
+    if (whisper_load() != 0) return -1;
+
+    size_t frames = audio->size / sizeof(short);
+    float *samples = malloc(frames * sizeof(float));
+    if (!samples) return -1;
+    for (size_t offset = 0, n; offset < audio->size; offset += n) {
+        const char *span = audio_store_span(audio, offset, audio->size, &n);
+        g_dsp->to_float((const short *)span, samples + offset / sizeof(short), n / sizeof(short));
+    }
+
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    wparams.n_threads = g_whisper_threads > 0 ? g_whisper_threads : (cpus > 0 ? (int)cpus : 4);
+    wparams.language = g_whisper_language ? g_whisper_language : "auto";
+    wparams.no_context = true;     // each recording stands alone
+    wparams.print_progress = false;
+    wparams.print_realtime = false;
+    wparams.print_timestamps = false;
+
+    int rc = whisper_full(g_whisper, wparams, samples, (int)frames);
+    free(samples);
+    if (rc != 0) {
+        fprintf(stderr, "whisper_full failed: %d\n", rc);
+        return -1;
+    }
+
+    int n = whisper_full_n_segments(g_whisper);
+    size_t total = 1;
+    for (int i = 0; i < n; i++) total += strlen(whisper_full_get_segment_text(g_whisper, i));
+    char *text = malloc(total);
+    if (!text) return -1;
+    size_t len = 0;
+    for (int i = 0; i < n; i++) {
+        const char *t = whisper_full_get_segment_text(g_whisper, i);
+        if (len == 0) while (*t == ' ') t++;
+        size_t tn = strlen(t);
+        memcpy(text + len, t, tn);
+        len += tn;
+    }
+    text[len] = '\0';
+    *result = text;
+    return 0;
+}
+
+static void whisper_evict(void) {
+    if (g_whisper) whisper_free(g_whisper);
+    g_whisper = NULL;
+}
+
+#endif
+
+static const TranscriberBackend g_backends[] = {
+    { "openai", 1, NULL, openai_transcribe, NULL, NULL },
+#ifdef HAVE_WHISPER
+    { "whisper", 0, whisper_load, whisper_transcribe, whisper_evict, whisper_evict },
+#endif
+};
+
+// Load the backend in the background while the user is still talking
+static void *backend_load_thread(void *arg) {
+    (void)arg;
+    if (g_backend->load() != 0) fprintf(stderr, "Backend %s failed to load\n", g_backend->name);
+    return NULL;
+}
+
+// Never waits: a busy lock means an earlier session is loading or using the model,
+// so it is resident anyway
+static void start_backend_load(void) {
+    if (!g_backend->load || pthread_mutex_trylock(&g_backend_lock) != 0) return;
+    if (!g_backend_loading)
+        g_backend_loading = pthread_create(&g_backend_thread, NULL, backend_load_thread, NULL) == 0;
+    pthread_mutex_unlock(&g_backend_lock);
+}
+
+// With g_backend_lock held
+static void join_backend_load(void) {
+    if (g_backend_loading) pthread_join(g_backend_thread, NULL);
+    g_backend_loading = 0;
+    g_backend_used_ms = monotonic_ms();
+}
+
+static void finish_backend_load(void) {
+    pthread_mutex_lock(&g_backend_lock);
+    join_backend_load();
+    pthread_mutex_unlock(&g_backend_lock);
+}
+
+// Local backends hold one model context, so overlapping sessions take turns on it;
+// a background load started by a newer session finishes before the model is used
+static int backend_transcribe(const AudioStore *audio, SessionTiming *timing, char **result) {
+    if (g_backend->remote) return g_backend->transcribe(audio, timing, result);
+    pthread_mutex_lock(&g_backend_lock);
+    join_backend_load();
+    int ret = g_backend->transcribe(audio, timing, result);
+    g_backend_used_ms = monotonic_ms();
+    pthread_mutex_unlock(&g_backend_lock);
+    return ret;
+}
+
+static const TranscriberBackend *find_backend(const char *name) {
+    for (size_t i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); i++) {
+        if (strcasecmp(g_backends[i].name, name) == 0) return &g_backends[i];
+    }
+    return NULL;
+}
+
+#ifdef HAVE_WAYLAND
+// Wayland output. The daemon owns the clipboard itself through wlr-data-control:
+// paste requests are served straight from the transcript in memory, with no
+// wl-copy process per result. The virtual-keyboard protocol types text into the
+// focused window instead. All Wayland calls happen on one thread; the others
+// queue requests for it.
+static struct {
+    struct wl_display *display;
+    struct wl_seat *seat;
+    struct zwlr_data_control_manager_v1 *data_control;
+    struct zwlr_data_control_device_v1 *device;
+    struct zwp_virtual_keyboard_manager_v1 *keyboard_manager;
+    struct zwp_virtual_keyboard_v1 *keyboard;
+    pthread_t thread;
+    atomic_int running;         // the thread is serving requests
+    int wake_fd;                // eventfd: a request was queued
+    pthread_mutex_t lock;       // guards the requests below
+    char *copy_request;
+    char *type_request;
+    int quit;
+} g_wl = { .wake_fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void wayland_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface,
+                           uint32_t version) {
+    (void)data;
+    (void)version;
+    if (strcmp(interface, wl_seat_interface.name) == 0 && !g_wl.seat) {
+        g_wl.seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+    } else if (strcmp(interface, zwlr_data_control_manager_v1_interface.name) == 0) {
+        g_wl.data_control = wl_registry_bind(registry, name, &zwlr_data_control_manager_v1_interface, 1);
+    } else if (strcmp(interface, zwp_virtual_keyboard_manager_v1_interface.name) == 0) {
+        g_wl.keyboard_manager = wl_registry_bind(registry, name, &zwp_virtual_keyboard_manager_v1_interface, 1);
+    }
+}
+
+static void wayland_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+    (void)data;
+    (void)registry;
+    (void)name;
+}
+
+static const struct wl_registry_listener g_wl_registry_listener = {
+    .global = wayland_global,
+    .global_remove = wayland_global_remove,
+};
+
+// The selection's text is the source's user data; it lives until the source is replaced
+static void data_source_send(void *data, struct zwlr_data_control_source_v1 *source, const char *mime_type,
+                             int32_t fd) {
+    (void)source;
+    (void)mime_type;
+    const char *p = data;
+    size_t left = strlen(p);
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        p += n;
+        left -= n;
+    }
+    close(fd);
+}
+
+static void data_source_cancelled(void *data, struct zwlr_data_control_source_v1 *source) {
+    zwlr_data_control_source_v1_destroy(source);
+    free(data);
+}
+
+static const struct zwlr_data_control_source_v1_listener g_wl_source_listener = {
+    .send = data_source_send,
+    .cancelled = data_source_cancelled,
+};
+
+static void data_device_offer(void *data, struct zwlr_data_control_device_v1 *device,
+                              struct zwlr_data_control_offer_v1 *offer) {
+    (void)data;
+    (void)device;
+    (void)offer;
+}
+
+// We never read the clipboard: let go of every offer as soon as it is announced
+static void data_device_selection(void *data, struct zwlr_data_control_device_v1 *device,
+                                  struct zwlr_data_control_offer_v1 *offer) {
+    (void)data;
+    (void)device;
+    if (offer) zwlr_data_control_offer_v1_destroy(offer);
+}
+
+static void data_device_finished(void *data, struct zwlr_data_control_device_v1 *device) {
+    (void)data;
+    zwlr_data_control_device_v1_destroy(device);
+    g_wl.device = NULL;
+}
+
+static const struct zwlr_data_control_device_v1_listener g_wl_device_listener = {
+    .data_offer = data_device_offer,
+    .selection = data_device_selection,
+    .finished = data_device_finished,
+    .primary_selection = data_device_selection,
+};
+
+// Take the selection; text is owned by the new source from here on
+static void wayland_set_selection(char *text) {
+    if (!g_wl.device) {
+        g_wl.device = zwlr_data_control_manager_v1_get_data_device(g_wl.data_control, g_wl.seat);
+        zwlr_data_control_device_v1_add_listener(g_wl.device, &g_wl_device_listener, NULL);
+    }
+    struct zwlr_data_control_source_v1 *source = zwlr_data_control_manager_v1_create_data_source(g_wl.data_control);
+    static const char *const mime_types[] = { "text/plain;charset=utf-8", "text/plain", "UTF8_STRING", "TEXT",
+                                              "STRING" };
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+        zwlr_data_control_source_v1_offer(source, mime_types[i]);
+    }
+    zwlr_data_control_source_v1_add_listener(source, &g_wl_source_listener, text);
+    zwlr_data_control_device_v1_set_selection(g_wl.device, source);
+}
+
+// Next code point of NUL-terminated UTF-8; malformed bytes come out as U+FFFD
+static uint32_t utf8_next(const unsigned char **p) {
+    const unsigned char *s = *p;
+    uint32_t cp;
+    int extra;
+    if (s[0] < 0x80) cp = s[0], extra = 0;
+    else if ((s[0] & 0xE0) == 0xC0) cp = s[0] & 0x1F, extra = 1;
+    else if ((s[0] & 0xF0) == 0xE0) cp = s[0] & 0x0F, extra = 2;
+    else if ((s[0] & 0xF8) == 0xF0) cp = s[0] & 0x07, extra = 3;
+    else {
+        (*p)++;
+        return 0xFFFD;
+    }
+    for (int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *p = s + i;
+            return 0xFFFD;
+        }
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    *p = s + extra + 1;
+    return cp;
+}
+
+// Install a keymap whose key i + 1 produces keys[i]: every character is bound to
+// its own Unicode keysym, so the user's layout never matters
+static int wayland_keymap(const uint32_t *keys, size_t count) {
+    char *map = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&map, &size);
+    if (!fp) return -1;
+    fprintf(fp, "xkb_keymap {\nxkb_keycodes \"vt\" {\nminimum = 8;\nmaximum = %zu;\n", count + 9);
+    for (size_t i = 0; i < count; i++) fprintf(fp, "<K%zu> = %zu;\n", i, i + 9);
+    fprintf(fp, "};\nxkb_types \"vt\" { include \"complete\" };\n"
+                "xkb_compatibility \"vt\" { include \"complete\" };\nxkb_symbols \"vt\" {\n");
+    for (size_t i = 0; i < count; i++) {
+        if (keys[i] == '\n') fprintf(fp, "key <K%zu> {[ Return ]};\n", i);
+        else if (keys[i] == '\t') fprintf(fp, "key <K%zu> {[ Tab ]};\n", i);
+        else fprintf(fp, "key <K%zu> {[ U%04X ]};\n", i, keys[i]);
+    }
+    fprintf(fp, "};\n};\n");
+    if (fclose(fp) != 0) {
+        free(map);
+        return -1;
+    }
+
+    // The compositor maps the keymap from a file, NUL terminator included
+    int fd = memfd_create("voice-transcribe-keymap", MFD_CLOEXEC);
+    int ok = fd >= 0 && write(fd, map, size + 1) == (ssize_t)(size + 1);
+    if (ok) {
+        zwp_virtual_keyboard_v1_keymap(g_wl.keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size + 1);
+        zwp_virtual_keyboard_v1_modifiers(g_wl.keyboard, 0, 0, 0, 0);
+    }
+    if (fd >= 0) close(fd);
+    free(map);
+    return ok ? 0 : -1;
+}
+
+// Type text into the focused window, one keymap per TYPE_KEYMAP_KEYS distinct characters
+static int wayland_type(const char *text) {
+    if (!g_wl.keyboard_manager || !g_wl.seat) return -1;
+    if (!g_wl.keyboard) {
+        g_wl.keyboard = zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(g_wl.keyboard_manager, g_wl.seat);
+    }
+
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p) {
+        uint32_t keys[TYPE_KEYMAP_KEYS];
+        size_t count = 0;
+        const unsigned char *end = p;
+        while (*end) {
+            const unsigned char *next = end;
+            uint32_t cp = utf8_next(&next);
+            size_t k = 0;
+            while (k < count && keys[k] != cp) k++;
+            if (k == count && (cp >= 0x20 || cp == '\n' || cp == '\t')) {
+                if (count == TYPE_KEYMAP_KEYS) break;
+                keys[count++] = cp;
+            }
+            end = next;
+        }
+        if (count > 0 && wayland_keymap(keys, count) < 0) return -1;
+
+        while (p < end) {
+            uint32_t cp = utf8_next(&p);
+            for (size_t k = 0; k < count; k++) {
+                if (keys[k] != cp) continue;
+                uint32_t now = (uint32_t)monotonic_ms();
+                zwp_virtual_keyboard_v1_key(g_wl.keyboard, now, k + 1, WL_KEYBOARD_KEY_STATE_PRESSED);
+                zwp_virtual_keyboard_v1_key(g_wl.keyboard, now, k + 1, WL_KEYBOARD_KEY_STATE_RELEASED);
+                break;
+            }
+        }
+        // The next keymap must not overtake keys still queued under this one
+        if (wl_display_roundtrip(g_wl.display) < 0) return -1;
+    }
+    return 0;
+}
+
+static int wayland_connect(void) {
+    g_wl.display = wl_display_connect(NULL);
+    if (!g_wl.display) return -1;
+    struct wl_registry *registry = wl_display_get_registry(g_wl.display);
+    wl_registry_add_listener(registry, &g_wl_registry_listener, NULL);
+    wl_display_roundtrip(g_wl.display);
+    wl_registry_destroy(registry);
+    return g_wl.seat ? 0 : -1;
+}
+
+static void wayland_disconnect(void) {
+    if (!g_wl.display) return;
+    if (g_wl.keyboard) zwp_virtual_keyboard_v1_destroy(g_wl.keyboard);
+    if (g_wl.keyboard_manager) zwp_virtual_keyboard_manager_v1_destroy(g_wl.keyboard_manager);
+    if (g_wl.device) zwlr_data_control_device_v1_destroy(g_wl.device);
+    if (g_wl.data_control) zwlr_data_control_manager_v1_destroy(g_wl.data_control);
+    if (g_wl.seat) wl_seat_destroy(g_wl.seat);
+    wl_display_flush(g_wl.display);
+    wl_display_disconnect(g_wl.display);
+    g_wl.display = NULL;
+    g_wl.seat = NULL;
+    g_wl.data_control = NULL;
+    g_wl.device = NULL;
+    g_wl.keyboard_manager = NULL;
+    g_wl.keyboard = NULL;
+}
+
+// Daemon output thread: dispatch compositor events (paste requests) and run what is queued
+static void *wayland_thread(void *arg) {
+    (void)arg;
+    struct pollfd fds[2] = {
+        { .fd = wl_display_get_fd(g_wl.display), .events = POLLIN },
+        { .fd = g_wl.wake_fd, .events = POLLIN },
+    };
+    for (;;) {
+        while (wl_display_prepare_read(g_wl.display) != 0) wl_display_dispatch_pending(g_wl.display);
+        wl_display_flush(g_wl.display);
+        if (poll(fds, 2, -1) < 0) {
+            wl_display_cancel_read(g_wl.display);
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) wl_display_read_events(g_wl.display);
+        else wl_display_cancel_read(g_wl.display);
+        if ((fds[0].revents & (POLLERR | POLLHUP)) || wl_display_dispatch_pending(g_wl.display) < 0) {
+            fprintf(stderr, "Lost the Wayland connection; falling back to wl-copy\n");
+            break;
+        }
+        if (!fds[1].revents) continue;
+
+        uint64_t value;
+        read(g_wl.wake_fd, &value, sizeof(value));
+        pthread_mutex_lock(&g_wl.lock);
+        char *copy = g_wl.copy_request, *type = g_wl.type_request;
+        int quit = g_wl.quit;
+        g_wl.copy_request = g_wl.type_request = NULL;
+        pthread_mutex_unlock(&g_wl.lock);
+
+        if (type) {
+            if (wayland_type(type) < 0 && !copy) copy = strdup(type); // at least leave it to paste
+            free(type);
+        }
+        if (copy) wayland_set_selection(copy);
+        if (quit) break;
+    }
+    atomic_store(&g_wl.running, 0);
+    return NULL;
+}
+
+// Daemon: connect once and serve the clipboard for as long as we run
+static void wayland_start(void) {
+    if (wayland_connect() < 0 || (!g_wl.data_control && !g_wl.keyboard_manager)) {
+        wayland_disconnect();
+        return;
+    }
+    g_wl.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_store(&g_wl.running, 1);
+    if (g_wl.wake_fd < 0 || pthread_create(&g_wl.thread, NULL, wayland_thread, NULL) != 0) {
+        atomic_store(&g_wl.running, 0);
+        if (g_wl.wake_fd >= 0) close(g_wl.wake_fd);
+        g_wl.wake_fd = -1;
+        wayland_disconnect();
+    }
+}
+
+static void wayland_stop(void) {
+    if (g_wl.wake_fd < 0) return;
+    pthread_mutex_lock(&g_wl.lock);
+    g_wl.quit = 1;
+    pthread_mutex_unlock(&g_wl.lock);
+    uint64_t one = 1;
+    write(g_wl.wake_fd, &one, sizeof(one));
+    pthread_join(g_wl.thread, NULL);
+    free(g_wl.copy_request);
+    free(g_wl.type_request);
+    g_wl.copy_request = g_wl.type_request = NULL;
+    close(g_wl.wake_fd);
+    g_wl.wake_fd = -1;
+    wayland_disconnect();
+}
+
+// Hand text to the output thread; -1 when it is not running or lacks the protocol
+static int wayland_queue(char **request, int available, const char *text) {
+    if (!atomic_load(&g_wl.running) || !available) return -1;
+    char *copy = strdup(text);
+    if (!copy) return -1;
+    pthread_mutex_lock(&g_wl.lock);
+    free(*request); // only the newest result matters
+    *request = copy;
+    pthread_mutex_unlock(&g_wl.lock);
+    uint64_t one = 1;
+    write(g_wl.wake_fd, &one, sizeof(one));
+    return 0;
+}
+#endif
+
+// Copy to clipboard: the daemon's own selection when it has one, otherwise wl-copy
+static void copy_to_clipboard(const char *text) {
+#ifdef HAVE_WAYLAND
+    if (wayland_queue(&g_wl.copy_request, g_wl.data_control != NULL, text) == 0) return;
+#endif
+    FILE *pipe = popen("wl-copy", "w");
+    if (pipe) {
+        fprintf(pipe, "%s", text);
+        pclose(pipe);
+    }
+}
+
+// Type into the focused window: the daemon's virtual keyboard, a short-lived one
+// of our own, or wtype; returns -1 if none of them worked
+static int type_text(const char *text) {
+#ifdef HAVE_WAYLAND
+    if (atomic_load(&g_wl.running)) {
+        if (wayland_queue(&g_wl.type_request, g_wl.keyboard_manager != NULL, text) == 0) return 0;
+    } else if (!g_wl.display) {
+        int ret = wayland_connect() == 0 ? wayland_type(text) : -1;
+        wayland_disconnect();
+        if (ret == 0) return 0;
+    }
+#endif
+    FILE *pipe = popen("wtype -", "w");
+    if (!pipe) return -1;
+    fprintf(pipe, "%s", text);
+    return pclose(pipe) == 0 ? 0 : -1;
+}
+
+// Deliver a session's transcript the way OUTPUT asks
+static void output_transcript(const char *text) {
+    int typed = (g_output & OUTPUT_TYPE) && type_text(text) == 0;
+    if ((g_output & OUTPUT_CLIPBOARD) || !typed) copy_to_clipboard(text);
+}
+
+// Transcript cache, $XDG_CACHE_HOME/voice-transcribe/transcripts: one file per
+// recording holding its transcript, named by a hash of the processed audio and of
+// every setting that changes the result. A file's mtime is its last use; past
+// TRANSCRIPT_CACHE entries the least recently used go first.
+static void cache_hash(uint64_t *h, const void *data, size_t size) {
+    const unsigned char *p = data;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        *h = (*h ^ w) * 0x100000001b3ULL; // FNV-1a a word at a time, folded so high bits mix down
+        *h ^= *h >> 32;
+    }
+    for (; size > 0; p++, size--) *h = (*h ^ *p) * 0x100000001b3ULL;
+}
+
+static uint64_t transcript_cache_key(const AudioStore *audio) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char *fields[] = {
+        g_backend->name,
+        g_backend->remote ? g_api_url : g_whisper_model,
+        g_backend->remote ? g_api_model : g_whisper_language,
+        g_backend->remote && g_upload_format ? g_upload_format->name : "",
+    };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        const char *s = fields[i] ? fields[i] : "";
+        cache_hash(&h, s, strlen(s) + 1);
+    }
+    for (size_t offset = 0, len; offset < audio->size; offset += len) {
+        const char *span = audio_store_span(audio, offset, audio->size, &len);
+        cache_hash(&h, span, len);
+    }
+    return h;
+}
+
+static void transcript_cache_dir(char *path, size_t size) {
+    snprintf(path, size, "%s/transcripts", cache_dir());
+}
+
+// The cached transcript at path, marked as just used; NULL if there is none
+static char *transcript_cache_read(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *text = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size < TRANSCRIPT_CACHE_MAX_BYTES &&
+        (text = malloc(st.st_size + 1))) {
+        if (read(fd, text, st.st_size) == st.st_size) {
+            text[st.st_size] = '\0';
+            futimens(fd, NULL);
+        } else {
+            free(text);
+            text = NULL;
+        }
+    }
+    close(fd);
+    return text;
+}
+
+static char *transcript_cache_get(uint64_t key) {
+    char dir[300], path[320];
+    transcript_cache_dir(dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)key);
+    return transcript_cache_read(path);
+}
+
+static int cache_entry_cmp(const void *a, const void *b) {
+    const struct timespec *x = &((const CacheEntry *)a)->used, *y = &((const CacheEntry *)b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// Every entry, least recently used first; returns the count (0 if none or on error)
+static size_t transcript_cache_list(const char *dir, CacheEntry **out) {
+    *out = NULL;
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    CacheEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        struct stat st;
+        if (strlen(de->d_name) != 16 || fstatat(dirfd(d), de->d_name, &st, 0) < 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            CacheEntry *grown = realloc(entries, capacity * sizeof(*entries));
+            if (!grown) break;
+            entries = grown;
+        }
+        entries[count].used = st.st_mtim;
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s", de->d_name);
+        count++;
+    }
+    closedir(d);
+    qsort(entries, count, sizeof(*entries), cache_entry_cmp);
+    *out = entries;
+    return count;
+}
+
+static void transcript_cache_put(uint64_t key, const char *text) {
+    char dir[300], path[320], tmp[330];
+    transcript_cache_dir(dir, sizeof(dir));
+    if (make_dirs(dir) < 0) return;
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)key);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return;
+    int ok = fputs(text, fp) >= 0;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return;
+    }
+
+    CacheEntry *entries;
+    size_t count = transcript_cache_list(dir, &entries);
+    for (size_t i = 0; i + g_transcript_cache < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        unlink(path);
+    }
+    free(entries);
+}
+
+// The transcript used most recently, from the cache; NULL if it is empty
+static char *transcript_cache_newest(void) {
+    char dir[300], path[320];
+    transcript_cache_dir(dir, sizeof(dir));
+    CacheEntry *entries;
+    size_t count = transcript_cache_list(dir, &entries);
+    char *text = NULL;
+    if (count > 0) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[count - 1].name);
+        text = transcript_cache_read(path);
+    }
+    free(entries);
+    return text;
+}
+
+// Transcript history: history.log holds the texts, history.idx one HistoryEntry
+// per text. Appends hold an exclusive flock on the index, so the daemon, its spool
+// worker and one-shot runs can all write; the index entry goes last, and a text
+// whose entry never landed is simply never referenced. Readers map both files and
+// touch only the pages they print or search.
+static const char *history_model(void) {
+    if (g_backend->remote) return g_api_model;
+    const char *slash = strrchr(g_whisper_model, '/');
+    return slash ? slash + 1 : g_whisper_model;
+}
+
+static int write_full(int fd, const void *data, size_t size) {
+    for (const char *p = data; size > 0;) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static void history_append(const char *text, time_t when, uint32_t audio_ms, uint32_t latency_ms,
+                           uint32_t flags) {
+    char dir[300], log_path[320], idx_path[320];
+    snprintf(dir, sizeof(dir), "%s", state_dir());
+    if (make_dirs(dir) < 0) return;
+    snprintf(log_path, sizeof(log_path), "%s/history.log", dir);
+    snprintf(idx_path, sizeof(idx_path), "%s/history.idx", dir);
+    int idx_fd = open(idx_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (idx_fd < 0) return;
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (log_fd < 0 || flock(idx_fd, LOCK_EX) < 0) {
+        if (log_fd >= 0) close(log_fd);
+        close(idx_fd);
+        return;
+    }
+
+    struct stat idx_st, log_st;
+    int ok = fstat(idx_fd, &idx_st) == 0 && fstat(log_fd, &log_st) == 0;
+    if (ok && (size_t)idx_st.st_size < sizeof(HistoryHeader)) {
+        HistoryHeader header = { .magic = HISTORY_MAGIC, .entry_size = sizeof(HistoryEntry) };
+        ok = ftruncate(idx_fd, 0) == 0 && write_full(idx_fd, &header, sizeof(header)) == 0;
+    } else if (ok) {
+        // Drop an entry torn by a crash mid-write so the ones after it stay aligned
+        size_t torn = (idx_st.st_size - sizeof(HistoryHeader)) % sizeof(HistoryEntry);
+        if (torn) ok = ftruncate(idx_fd, idx_st.st_size - torn) == 0;
+    }
+
+    size_t length = strlen(text);
+    HistoryEntry entry = {
+        .time = when, .offset = log_st.st_size, .length = length,
+        .audio_ms = audio_ms, .latency_ms = latency_ms, .flags = flags,
+    };
+    snprintf(entry.model, sizeof(entry.model), "%s", history_model());
+    if (ok && write_full(log_fd, text, length) == 0 && write_full(log_fd, "\n", 1) == 0) {
+        write_full(idx_fd, &entry, sizeof(entry));
+    }
+    flock(idx_fd, LOCK_UN);
+    close(log_fd);
+    close(idx_fd);
+}
+
+// Both history files mapped read-only
+typedef struct {
+    void *idx_map;
+    size_t idx_size;
+    const HistoryEntry *entries;
+    size_t count;
+    const char *log;
+    size_t log_size;
+} HistoryView;
+
+static void *history_map(const char *path, size_t *size) {
+    *size = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        else *size = st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+static void history_close(HistoryView *h) {
+    if (h->idx_map) munmap(h->idx_map, h->idx_size);
+    if (h->log) munmap((void *)h->log, h->log_size);
+    memset(h, 0, sizeof(*h));
+}
+
+static int history_open(HistoryView *h) {
+    char path[320];
+    memset(h, 0, sizeof(*h));
+    snprintf(path, sizeof(path), "%s/history.idx", state_dir());
+    h->idx_map = history_map(path, &h->idx_size);
+    snprintf(path, sizeof(path), "%s/history.log", state_dir());
+    h->log = history_map(path, &h->log_size);
+
+    const HistoryHeader *header = h->idx_map;
+    if (!h->log || h->idx_size < sizeof(*header) || memcmp(header->magic, HISTORY_MAGIC, 8) != 0 ||
+        header->entry_size != sizeof(HistoryEntry)) {
+        history_close(h);
+        return -1;
+    }
+    h->entries = (const HistoryEntry *)(header + 1);
+    h->count = (h->idx_size - sizeof(*header)) / sizeof(HistoryEntry);
+    return 0;
+}
+
+// An entry's text in the mapped log, or NULL if the log doesn't reach that far
+static const char *history_text(const HistoryView *h, const HistoryEntry *e) {
+    if (e->offset > h->log_size || e->length > h->log_size - e->offset) return NULL;
+    return h->log + e->offset;
+}
 
-    // Write visualization script
-    FILE *script_file = fopen("/tmp/voice_viz.py", "w");
-    if (script_file) {
-        fprintf(script_file, "%s", viz_script);
-        fclose(script_file);
-        chmod("/tmp/voice_viz.py", 0755);
+static void history_print(const HistoryView *h, const HistoryEntry *e) {
+    const char *text = history_text(h, e);
+    if (!text) return;
+    char when[32];
+    time_t t = (time_t)e->time;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+    printf("%s %6.1fs%s ", when, e->audio_ms / 1000.0, e->flags & HISTORY_SPOOLED ? "*" : " ");
+    fwrite(text, 1, e->length, stdout);
+    putchar('\n');
+}
 
-        // Launch the visualizer in background with low priority
-        system("nice -n 10 python3 /tmp/voice_viz.py > /dev/null 2>&1 &");
+// --history [N]: the last N transcripts, oldest first
+static int print_history(int rows) {
+    HistoryView h;
+    if (history_open(&h) < 0) {
+        fprintf(stderr, "No history recorded yet (%s/history.idx)\n", state_dir());
+        return 1;
     }
+    size_t first = rows > 0 && (size_t)rows < h.count ? h.count - rows : 0;
+    for (size_t i = first; i < h.count; i++) history_print(&h, &h.entries[i]);
+    history_close(&h);
+    return 0;
+}
 
-    // Keep updating status while recording or processing
-    while (!g_stop_recording) {
-        update_status("RECORDING", g_current_level);
-        usleep(50000); // 20 FPS
+// Case-insensitive (ASCII) substring test on text that isn't NUL-terminated
+static int history_contains(const char *text, size_t length, const char *word) {
+    size_t n = strlen(word);
+    if (n == 0) return 1;
+    int first = tolower((unsigned char)word[0]);
+    for (size_t i = 0; i + n <= length; i++) {
+        if (tolower((unsigned char)text[i]) == first && strncasecmp(text + i, word, n) == 0) return 1;
     }
-
-    // Don't immediately stop - wait for final status
-    usleep(100000);
-    unlink("/tmp/voice_viz.py");
-
-    return NULL;
+    return 0;
 }
 
-// Recording thread
-static void *recording_thread(void *arg) {
-    snd_pcm_t *capture_handle;
-    snd_pcm_hw_params_t *hw_params;
-    int err;
-    short buffer[BUFFER_SIZE];
-
-    // Try direct hardware access first for faster startup, fallback to default
-    if ((err = snd_pcm_open(&capture_handle, "plughw:0,0", SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK)) < 0) {
-        // Fallback to default (might be PulseAudio)
-        if ((err = snd_pcm_open(&capture_handle, "default", SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-            fprintf(stderr, "Cannot open audio device: %s\n", snd_strerror(err));
-            update_status("ERROR: Audio device failed", 0.0);
-            return NULL;
+// --search WORD...: every transcript containing all the words, oldest first
+static int search_history(int count, char **words) {
+    HistoryView h;
+    if (history_open(&h) < 0) {
+        fprintf(stderr, "No history recorded yet (%s/history.idx)\n", state_dir());
+        return 1;
+    }
+    size_t found = 0;
+    for (size_t i = 0; i < h.count; i++) {
+        const HistoryEntry *e = &h.entries[i];
+        const char *text = history_text(&h, e);
+        int match = text != NULL;
+        for (int w = 0; match && w < count; w++) match = history_contains(text, e->length, words[w]);
+        if (match) {
+            history_print(&h, e);
+            found++;
         }
     }
+    history_close(&h);
+    return found ? 0 : 1;
+}
 
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_handle, hw_params);
-    snd_pcm_hw_params_set_access(capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(capture_handle, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(capture_handle, hw_params, SAMPLE_RATE, 0);
-    snd_pcm_hw_params_set_channels(capture_handle, hw_params, CHANNELS);
-
-    if ((err = snd_pcm_hw_params(capture_handle, hw_params)) < 0) {
-        fprintf(stderr, "Cannot set hardware parameters: %s\n", snd_strerror(err));
-        snd_pcm_close(capture_handle);
-        return NULL;
+// The newest transcript in the history, or NULL
+static char *history_newest(void) {
+    HistoryView h;
+    if (history_open(&h) < 0) return NULL;
+    char *text = NULL;
+    for (size_t i = h.count; i > 0 && !text; i--) {
+        const char *at = history_text(&h, &h.entries[i - 1]);
+        if (at) text = strndup(at, h.entries[i - 1].length);
     }
+    history_close(&h);
+    return text;
+}
+
+// Remember a delivered transcript for "re-copy last transcript"
+static void remember_transcript(const char *text) {
+    char *copy = strdup(text);
+    pthread_mutex_lock(&g_last_lock);
+    free(g_last_transcript);
+    g_last_transcript = copy;
+    pthread_mutex_unlock(&g_last_lock);
+}
 
-    snd_pcm_prepare(capture_handle);
+// Copy the last transcript again: the daemon's own copy, else the newest history
+// entry, else the newest cache entry
+static int recopy_transcript(void) {
+    pthread_mutex_lock(&g_last_lock);
+    char *text = g_last_transcript ? strdup(g_last_transcript) : NULL;
+    pthread_mutex_unlock(&g_last_lock);
+    if (!text) text = history_newest();
+    if (!text) text = transcript_cache_newest();
+    if (!text) return -1;
+    copy_to_clipboard(text);
+    free(text);
+    return 0;
+}
 
-    // Initialize buffer BEFORE any delays
-    init_audio_buffer(&g_audio_buffer, SAMPLE_RATE * 2 * 10);
+// Offline spool: recordings whose upload failed wait in
+// $XDG_STATE_HOME/voice-transcribe/spool until the daemon can deliver them.
+// Each file is a one-line text header followed by the audio exactly as uploaded
+// (raw PCM for wav):  VTSPOOL1 <format> <recorded unix time> <frames>\n
+static void spool_kick(void) {
+    pthread_mutex_lock(&g_spool_lock);
+    g_spool_kicked = 1;
+    pthread_cond_signal(&g_spool_cond);
+    pthread_mutex_unlock(&g_spool_lock);
+}
 
-    // Signal that mic is ready
-    update_status("READY", 0.0);
-    usleep(200000); // Brief pause to show ready status
-    update_status("RECORDING", 0.0);
+// Save a recording that could not be transcribed: the session's encoded file if it
+// has one, otherwise its PCM, compressed when a codec is built in
+static int spool_write(const Encoder *encoded, const AudioStore *pcm) {
+    char dir[300], tmp[420], path[400];
+    snprintf(dir, sizeof(dir), "%s/spool", state_dir());
+    if (make_dirs(dir) < 0) return -1;
 
-    // Start recording immediately
-    while (!g_stop_recording) {
-        // Check timeout
-        if (time(NULL) - g_record_start_time > MAX_RECORDING_TIME) {
-            update_status("MAX_TIME", 0.0);
-            break;
+    Encoder *enc = NULL;
+    if (!encoded) {
+        const EncoderType *lossless = find_encoder_type("flac");
+        enc = encoder_new(lossless ? lossless : find_encoder_type("opus"));
+        if (enc && (audio_store_encode(enc, pcm, 0, pcm->size) != 0 || enc->type->finish(enc) != 0)) {
+            encoder_free(enc);
+            enc = NULL;
         }
+        encoded = enc;
+    }
+    const EncoderType *format = encoded ? encoded->type : &g_encoder_types[0];
+    size_t frames = pcm->size / sizeof(short);
 
-        int frames = snd_pcm_readi(capture_handle, buffer, BUFFER_SIZE);
-        if (frames < 0) {
-            frames = snd_pcm_recover(capture_handle, frames, 0);
-        }
-        if (frames > 0) {
-            append_audio_buffer(&g_audio_buffer, buffer, frames * 2);
+    // Names sort by age; written under a temporary name so the drain never sees half a file
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(path, sizeof(path), "%s/%013lld-%d.vts", dir,
+             (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000, (int)getpid());
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
-            // Calculate current audio level
-            float max_amp = 0.0f;
-            for (int i = 0; i < frames; i++) {
-                float amp = fabsf((float)buffer[i] / 32768.0f);
-                if (amp > max_amp) max_amp = amp;
+    int ret = -1;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp) {
+        fprintf(fp, "%s %s %lld %zu\n", SPOOL_MAGIC, format->name, (long long)now.tv_sec, frames);
+        int ok = 1;
+        if (encoded) {
+            ok = fwrite(encoded->out.data, 1, encoded->out.size, fp) == encoded->out.size;
+        } else {
+            for (size_t offset = 0, n; ok && offset < pcm->size; offset += n) {
+                const char *span = audio_store_span(pcm, offset, pcm->size, &n);
+                ok = fwrite(span, 1, n, fp) == n;
             }
-            g_current_level = max_amp;
         }
+        if (fclose(fp) == 0 && ok && rename(tmp, path) == 0) ret = 0;
+        else unlink(tmp);
     }
-
-    snd_pcm_close(capture_handle);
-    return NULL;
+    encoder_free(enc);
+    if (ret == 0) g_spool_pending = 1; // sent when the next upload shows we're back online
+    return ret;
 }
 
-// Transcribe audio
-static int transcribe_audio(const void *audio_data, size_t audio_size, char **result) {
-    CURL *curl;
-    CURLcode res;
-    struct curl_httppost *formpost = NULL;
-    struct curl_httppost *lastptr = NULL;
-    CurlResponse response = {0};
-
-    // Create WAV file
-    char temp_filename[] = "/tmp/audio_XXXXXX.wav";
-    int fd = mkstemps(temp_filename, 4);
-    if (fd < 0) return -1;
+// A late transcript always lands in the history unless it goes to the clipboard
+// and the history is off
+static void spool_deliver(const char *text, time_t recorded, uint32_t audio_ms) {
+    if (g_spool_to_clipboard) copy_to_clipboard(text);
+    if (g_history || !g_spool_to_clipboard) history_append(text, recorded, audio_ms, 0, HISTORY_SPOOLED);
+}
 
-    // WAV header
-    struct {
-        char riff[4];
-        uint32_t size;
-        char wave[4];
-        char fmt[4];
-        uint32_t fmt_size;
-        uint16_t format;
-        uint16_t channels;
-        uint32_t sample_rate;
-        uint32_t byte_rate;
-        uint16_t block_align;
-        uint16_t bits_per_sample;
-        char data[4];
-        uint32_t data_size;
-    } __attribute__((packed)) wav_header = {
-        .riff = {'R', 'I', 'F', 'F'},
-        .size = 36 + audio_size,
-        .wave = {'W', 'A', 'V', 'E'},
-        .fmt = {'f', 'm', 't', ' '},
-        .fmt_size = 16,
-        .format = 1,
-        .channels = CHANNELS,
-        .sample_rate = SAMPLE_RATE,
-        .byte_rate = SAMPLE_RATE * CHANNELS * 2,
-        .block_align = CHANNELS * 2,
-        .bits_per_sample = 16,
-        .data = {'d', 'a', 't', 'a'},
-        .data_size = audio_size
-    };
+// Try one spooled file: 0 delivered or set aside as undeliverable, 1 still offline
+static int spool_send(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
 
-    write(fd, &wav_header, sizeof(wav_header));
-    write(fd, audio_data, audio_size);
-    close(fd);
+    char magic[16], name[16];
+    long long recorded;
+    size_t frames;
+    int parsed = fscanf(fp, "%15s %15s %lld %zu", magic, name, &recorded, &frames) == 4 &&
+                 strcmp(magic, SPOOL_MAGIC) == 0 && fgetc(fp) == '\n';
+    const EncoderType *format = parsed ? find_encoder_type(name) : NULL;
 
-    curl = curl_easy_init();
-    if (!curl) {
-        unlink(temp_filename);
-        return -1;
+    AudioBuffer body = {0};
+    if (format) {
+        long start = ftell(fp);
+        fseek(fp, 0, SEEK_END);
+        long end = ftell(fp);
+        fseek(fp, start, SEEK_SET);
+        init_audio_buffer(&body, end > start ? end - start : 1);
+        if (body.data) body.size = fread(body.data, 1, body.capacity, fp);
     }
+    fclose(fp);
 
-    // Build form
-    curl_formadd(&formpost, &lastptr,
-                 CURLFORM_COPYNAME, "file",
-                 CURLFORM_FILE, temp_filename,
-                 CURLFORM_END);
-
-    curl_formadd(&formpost, &lastptr,
-                 CURLFORM_COPYNAME, "model",
-                 CURLFORM_COPYCONTENTS, "whisper-1",
-                 CURLFORM_END);
+    int outcome = -1;
+    char *text = NULL;
+    if (format && body.size > 0) {
+        WavHeader wav_header;
+        MemReader reader = { .data = body.data, .size = body.size };
+        if (!format->init) {
+            fill_wav_header(&wav_header, body.size);
+            reader.head = (const char *)&wav_header;
+            reader.head_size = sizeof(wav_header);
+        }
+        long retry_after_ms = 0;
+        outcome = transcribe_attempt(NULL, &reader, format, &text, &retry_after_ms, NULL);
+    }
+    free_audio_buffer(&body);
 
-    // Setup CURL
-    struct curl_slist *headers = NULL;
-    char auth_header[256];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", g_api_key);
-    headers = curl_slist_append(headers, auth_header);
+    if (outcome == 0) {
+        spool_deliver(text, (time_t)recorded, frames * 1000 / SAMPLE_RATE);
+        free(text);
+        unlink(path);
+    } else if (outcome < 0) {
+        // Rejected or unreadable: keep it for the user rather than retrying forever
+        char bad[620];
+        snprintf(bad, sizeof(bad), "%s.bad", path);
+        rename(path, bad);
+        fprintf(stderr, "Spooled recording %s could not be transcribed\n", path);
+    }
+    g_offline = outcome > 0;
+    return outcome > 0;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/audio/transcriptions");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+static int spool_name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    res = curl_easy_perform(curl);
+// Deliver spooled recordings oldest first, one at a time; returns 1 if we gave up offline
+static int spool_drain(void) {
+    char dir[300];
+    snprintf(dir, sizeof(dir), "%s/spool", state_dir());
+    DIR *d = opendir(dir);
+    if (!d) return 0;
 
-    curl_formfree(formpost);
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    unlink(temp_filename);
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        size_t len = strlen(ent->d_name);
+        if (len < 4 || strcmp(ent->d_name + len - 4, ".vts") != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if (!grown) break;
+            names = grown;
+        }
+        names[count++] = strdup(ent->d_name);
+    }
+    closedir(d);
+    if (count) qsort(names, count, sizeof(char *), spool_name_cmp);
 
-    if (res != CURLE_OK) {
-        fprintf(stderr, "CURL error: %s\n", curl_easy_strerror(res));
-        free(response.data);
-        return -1;
+    int offline = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!offline && !g_daemon_quit && names[i]) {
+            char path[600];
+            snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+            offline = spool_send(path);
+        }
+        free(names[i]);
     }
+    free(names);
+    return offline;
+}
 
-    // Parse JSON response
-    char *text_start = strstr(response.data, "\"text\":\"");
-    if (text_start) {
-        text_start += 8;
-        char *text_end = strchr(text_start, '"');
-        if (text_end) {
-            size_t text_len = text_end - text_start;
-            *result = malloc(text_len + 1);
-            memcpy(*result, text_start, text_len);
-            (*result)[text_len] = '\0';
-
-            // Unescape JSON
-            char *src = *result, *dst = *result;
-            while (*src) {
-                if (*src == '\\' && *(src + 1)) {
-                    src++;
-                    switch (*src) {
-                        case 'n': *dst++ = '\n'; break;
-                        case 't': *dst++ = '\t'; break;
-                        case 'r': *dst++ = '\r'; break;
-                        case '"': *dst++ = '"'; break;
-                        case '\\': *dst++ = '\\'; break;
-                        default: *dst++ = *src; break;
-                    }
-                    src++;
-                } else {
-                    *dst++ = *src++;
-                }
-            }
-            *dst = '\0';
+// Daemon worker: drain at startup, whenever something is spooled or the network came
+// back, and on a backoff timer while offline
+static void *spool_thread(void *arg) {
+    (void)arg;
+    int backoff_s = SPOOL_RETRY_S;
+    while (!g_daemon_quit) {
+        int offline = spool_drain();
+        g_spool_pending = offline;
+        backoff_s = offline ? (backoff_s * 2 > SPOOL_MAX_RETRY_S ? SPOOL_MAX_RETRY_S : backoff_s * 2)
+                            : SPOOL_RETRY_S;
+
+        pthread_mutex_lock(&g_spool_lock);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += offline ? backoff_s : SPOOL_MAX_RETRY_S;
+        while (!g_spool_kicked && !g_daemon_quit &&
+               pthread_cond_timedwait(&g_spool_cond, &g_spool_lock, &deadline) != ETIMEDOUT) {
         }
+        g_spool_kicked = 0;
+        pthread_mutex_unlock(&g_spool_lock);
     }
+    return NULL;
+}
 
-    free(response.data);
-    return *result ? 0 : -1;
+static void start_spool_worker(void) {
+    if (!g_spool_enabled) return;
+    g_spool_running = pthread_create(&g_spool_thread, NULL, spool_thread, NULL) == 0;
 }
 
-// Removed - not inserting text anymore
+static void stop_spool_worker(void) {
+    if (!g_spool_running) return;
+    spool_kick();
+    pthread_join(g_spool_thread, NULL);
+    g_spool_running = 0;
+}
 
-// Copy to clipboard
-static void copy_to_clipboard(const char *text) {
-    FILE *pipe = popen("wl-copy", "w");
-    if (pipe) {
-        fprintf(pipe, "%s", text);
-        pclose(pipe);
+// Apply one KEY=VALUE setting from .env
+static void apply_setting(const char *key, const char *value) {
+    if (strcmp(key, "OPENAI_API_KEY") == 0) {
+        free(g_api_key);
+        g_api_key = strdup(value);
+    } else if (strcmp(key, "STREAM_UPLOAD") == 0) {
+        g_stream_upload = atoi(value) != 0;
+    } else if (strcmp(key, "SEGMENT_SECONDS") == 0) {
+        g_segment_seconds = atoi(value) > 0 ? atoi(value) : 0;
+    } else if (strcmp(key, "BACKEND") == 0) {
+        g_backend = find_backend(value);
+        if (!g_backend) fprintf(stderr, "Backend '%s' not available, using openai\n", value);
+    } else if (strcmp(key, "WHISPER_MODEL") == 0) {
+        free(g_whisper_model);
+        g_whisper_model = strdup(value);
+    } else if (strcmp(key, "WHISPER_LANGUAGE") == 0) {
+        free(g_whisper_language);
+        g_whisper_language = strdup(value);
+    } else if (strcmp(key, "WHISPER_THREADS") == 0) {
+        if (atoi(value) >= 0) g_whisper_threads = atoi(value);
+    } else if (strcmp(key, "WHISPER_GPU") == 0) {
+        g_whisper_gpu = atoi(value) != 0;
+    } else if (strcmp(key, "WHISPER_IDLE_MINUTES") == 0) {
+        if (atoi(value) >= 0) g_backend_idle_minutes = atoi(value);
+    } else if (strcmp(key, "UPLOAD_RETRIES") == 0) {
+        if (atoi(value) >= 0) g_upload_retries = atoi(value);
+    } else if (strcmp(key, "HEDGE_AFTER_MS") == 0) {
+        g_hedge_after_ms = atoi(value) > 0 ? atoi(value) : 0;
+    } else if (strcmp(key, "SPOOL") == 0) {
+        g_spool_enabled = atoi(value) != 0;
+    } else if (strcmp(key, "SPOOL_DELIVERY") == 0) {
+        g_spool_to_clipboard = strcasecmp(value, "clipboard") == 0;
+    } else if (strcmp(key, "API_URL") == 0) {
+        if (g_api_url != g_default_api_url) free((char *)g_api_url);
+        g_api_url = strdup(value);
+    } else if (strcmp(key, "API_MODEL") == 0) {
+        if (g_api_model != g_default_api_model) free((char *)g_api_model);
+        g_api_model = strdup(value);
+    } else if (strcmp(key, "CAPTURE_DEVICE") == 0) {
+        free(g_capture_device);
+        g_capture_device = value[0] ? strdup(value) : NULL;
+    } else if (strcmp(key, "CAPTURE_BACKEND") == 0) {
+        free(g_capture_backend);
+        g_capture_backend = value[0] ? strdup(value) : NULL;
+    } else if (strcmp(key, "CAPTURE_RATE") == 0) {
+        g_capture_rate = atoi(value) > 0 ? atoi(value) : 0;
+    } else if (strcmp(key, "OUTPUT") == 0) {
+        if (strcasecmp(value, "type") == 0) g_output = OUTPUT_TYPE;
+        else if (strcasecmp(value, "both") == 0) g_output = OUTPUT_CLIPBOARD | OUTPUT_TYPE;
+        else g_output = OUTPUT_CLIPBOARD;
+    } else if (strcmp(key, "TRANSCRIPT_CACHE") == 0) {
+        g_transcript_cache = atoi(value) > 0 ? atoi(value) : 0;
+    } else if (strcmp(key, "HISTORY") == 0) {
+        g_history = atoi(value) != 0;
+    } else if (strcmp(key, "TIMING_LOG") == 0) {
+        g_timing_log = atoi(value) != 0;
+    } else if (strcmp(key, "LIVE_TRANSCRIPT") == 0) {
+        g_live_transcript = atoi(value) != 0;
+    } else if (strcmp(key, "UPLOAD_FORMAT") == 0) {
+        g_upload_format = find_encoder_type(value);
+        if (!g_upload_format) fprintf(stderr, "Upload format '%s' not available, using wav\n", value);
+    } else if (strcmp(key, "OPUS_BITRATE") == 0) {
+        if (atoi(value) > 0) g_opus_bitrate = atoi(value);
+    } else if (strcmp(key, "VAD") == 0) {
+        g_vad_enabled = atoi(value) != 0;
+    } else if (strcmp(key, "VAD_MAX_SILENCE_MS") == 0) {
+        if (atoi(value) >= 0) g_vad_max_silence_ms = atoi(value);
+    } else if (strcmp(key, "VAD_THRESHOLD_DB") == 0) {
+        g_vad_threshold_db = atof(value);
+    } else if (strcmp(key, "INPUT_GAIN_DB") == 0) {
+        g_input_gain_db = atof(value);
+        if (g_input_gain_db > 18.0f) g_input_gain_db = 18.0f;
+        g_input_gain_q12 = (int)lrintf(4096.0f * powf(10.0f, g_input_gain_db / 20.0f));
+        // The SIMD kernels multiply by a 16-bit gain; clamp here so every kernel sees the same value
+        if (g_input_gain_q12 > 32767) g_input_gain_q12 = 32767;
+    } else if (strcmp(key, "SIMD") == 0) {
+        dsp_init(value);
+    } else if (strcmp(key, "PRECONNECT") == 0) {
+        g_preconnect = atoi(value) != 0;
+    } else if (strcmp(key, "PERIOD_FRAMES") == 0) {
+        int frames = atoi(value);
+        if (frames >= 64 && frames <= BUFFER_SIZE) g_period_frames = frames;
+    } else if (strcmp(key, "PREROLL_MS") == 0) {
+        g_preroll_ms = atoi(value);
+        if (g_preroll_ms < 0) g_preroll_ms = 0;
+        if (g_preroll_ms > MAX_PREROLL_MS) g_preroll_ms = MAX_PREROLL_MS;
+    } else if (strcmp(key, "MAX_RECORDING_TIME") == 0) {
+        if (atoi(value) > 0) g_max_recording_time = atoi(value);
     }
 }
 
-// Load .env
+// Settings file: $VOICE_TRANSCRIBE_CONFIG, else $XDG_CONFIG_HOME/voice-transcribe/config,
+// else a .env next to the executable, else ./.env
 static void load_env(void) {
-    FILE *fp = fopen("/home/zack/work/transcribe/.env", "r");
-    if (!fp) {
-        fp = fopen(".env", "r");
+    char path[PATH_MAX + 8];
+    FILE *fp = NULL;
+    const char *explicit_path = getenv("VOICE_TRANSCRIBE_CONFIG");
+    if (explicit_path && explicit_path[0]) {
+        fp = fopen(explicit_path, "r");
+    } else {
+        snprintf(path, sizeof(path), "%s/config", config_dir());
+        fp = fopen(path, "r");
+        ssize_t n;
+        if (!fp && (n = readlink("/proc/self/exe", path, PATH_MAX)) > 0) {
+            path[n] = '\0';
+            char *slash = strrchr(path, '/');
+            if (slash) {
+                strcpy(slash + 1, ".env");
+                fp = fopen(path, "r");
+            }
+        }
+        if (!fp) fp = fopen(".env", "r");
     }
     if (!fp) {
-        fprintf(stderr, "Cannot open .env file\n");
+        fprintf(stderr, "Cannot open a settings file (%s/config or .env)\n", config_dir());
         return;
     }
 
     char line[512];
     while (fgets(line, sizeof(line), fp)) {
-        if (strncmp(line, "OPENAI_API_KEY=", 15) == 0) {
-            char *value = line + 15;
-            char *end = strchr(value, '\n');
-            if (end) *end = '\0';
-            if (value[0] == '"' || value[0] == '\'') {
-                value++;
-                char *last = value + strlen(value) - 1;
-                if (*last == '"' || *last == '\'') *last = '\0';
-            }
-            g_api_key = strdup(value);
-            break;
+        if (line[0] == '#') continue;
+        char *value = strchr(line, '=');
+        if (!value) continue;
+        *value++ = '\0';
+        char *end = strpbrk(value, "\r\n");
+        if (end) *end = '\0';
+        if (value[0] == '"' || value[0] == '\'') {
+            value++;
+            size_t len = strlen(value);
+            if (len > 0 && (value[len - 1] == '"' || value[len - 1] == '\'')) value[len - 1] = '\0';
         }
+        apply_setting(line, value);
+    }
+    fclose(fp);
+}
+
+// Timing log: one JSON line per session with each milestone as ms after the trigger
+static const char *const g_timing_keys[] = {
+    "device_open", "first_frame", "stop", "captured", "encoded", "upload_start", "connect",
+    "tls", "first_byte", "last_byte", "transcribed", "clipboard", "stop_to_clipboard",
+};
+#define TIMING_KEYS (sizeof(g_timing_keys) / sizeof(g_timing_keys[0]))
+
+// Offsets in key order; -1 where the milestone didn't happen
+static void timing_offsets(const SessionTiming *t, int64_t *out) {
+    const TransferTimes *u = &t->upload;
+    uint64_t stop = t->stop ? t->stop : t->captured;
+    uint64_t at[TIMING_KEYS] = {
+        t->device_open, t->first_frame, stop, t->captured, t->encoded, u->start_ms,
+        u->start_ms && u->connect ? u->start_ms + u->connect : 0,
+        u->start_ms && u->tls ? u->start_ms + u->tls : 0,
+        u->start_ms ? u->start_ms + u->first_byte : 0,
+        u->start_ms ? u->start_ms + u->last_byte : 0,
+        t->transcribed, t->clipboard, 0,
+    };
+    for (size_t i = 0; i < TIMING_KEYS; i++) {
+        out[i] = at[i] >= t->trigger && at[i] ? (int64_t)(at[i] - t->trigger) : -1;
+    }
+    out[TIMING_KEYS - 1] = stop && t->clipboard >= stop ? (int64_t)(t->clipboard - stop) : -1;
+}
+
+// Everything but the closing brace, so callers can add their own fields
+static void timing_record(FILE *fp, const Session *s, const char *outcome) {
+    int64_t offsets[TIMING_KEYS];
+    timing_offsets(&s->timing, offsets);
+    fprintf(fp, "{\"time\":%lld,\"backend\":\"%s\",\"format\":\"%s\",\"mode\":\"%s\","
+            "\"outcome\":\"%s\",\"audio_ms\":%llu",
+            (long long)time(NULL), g_backend->name,
+            s->encoder ? s->encoder->type->name : g_upload_format ? g_upload_format->name : "wav",
+            !g_backend->remote ? "local" : g_segment_seconds > 0 ? "segments" : g_stream_upload ? "stream" : "buffered",
+            outcome, (unsigned long long)s->timing.audio_ms);
+    for (size_t i = 0; i < TIMING_KEYS; i++) {
+        if (offsets[i] >= 0) fprintf(fp, ",\"%s\":%lld", g_timing_keys[i], (long long)offsets[i]);
+    }
+}
+
+static void timing_log_write(const Session *s, const char *outcome) {
+    if (!g_timing_log || !s->timing.trigger) return;
+    char dir[300], path[320], old[330];
+    snprintf(dir, sizeof(dir), "%s", state_dir());
+    if (make_dirs(dir) < 0) return;
+    snprintf(path, sizeof(path), "%s/timings.jsonl", dir);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size > TIMING_LOG_MAX_BYTES) {
+        snprintf(old, sizeof(old), "%s.1", path);
+        rename(path, old);
+    }
+    FILE *fp = fopen(path, "a");
+    if (!fp) return;
+    timing_record(fp, s, outcome);
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+static void json_write_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+// --replay result on stdout: the timing record plus resource use and the transcript
+static void replay_report(const Session *s, const char *outcome) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    timing_record(stdout, s, outcome);
+    printf(",\"fixture\":");
+    json_write_string(stdout, g_replay.path);
+    printf(",\"capture_cpu_us\":%llu,\"process_cpu_us\":%llu,\"peak_rss_kb\":%ld,\"uploaded_bytes\":%llu,\"text\":",
+           (unsigned long long)s->timing.capture_cpu_us, (unsigned long long)s->timing.process_cpu_us,
+           ru.ru_maxrss, (unsigned long long)atomic_load(&s->timing.uploaded));
+    json_write_string(stdout, g_replay.result ? g_replay.result : "");
+    printf("}\n");
+    fflush(stdout);
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// --stats: nearest-rank p50/p95 of every milestone over the most recent sessions
+static int print_stats(void) {
+    char path[320];
+    snprintf(path, sizeof(path), "%s/timings.jsonl", state_dir());
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "No timings recorded yet (%s)\n", path);
+        return 1;
     }
+
+    // The file only grows at the end: keep a ring of the last STATS_SESSIONS lines
+    static char lines[STATS_SESSIONS][1024];
+    size_t count = 0;
+    while (fgets(lines[count % STATS_SESSIONS], sizeof(lines[0]), fp)) count++;
     fclose(fp);
+    size_t n = count < STATS_SESSIONS ? count : STATS_SESSIONS;
+
+    printf("Last %zu sessions, ms after the hotkey (stop_to_clipboard: after stop)\n", n);
+    printf("%-18s %6s %8s %8s\n", "stage", "n", "p50", "p95");
+    for (size_t k = 0; k < TIMING_KEYS; k++) {
+        int64_t values[STATS_SESSIONS];
+        size_t found = 0;
+        char needle[64];
+        snprintf(needle, sizeof(needle), "\"%s\":", g_timing_keys[k]);
+        for (size_t i = 0; i < n; i++) {
+            const char *at = strstr(lines[i], needle);
+            if (at) values[found++] = strtoll(at + strlen(needle), NULL, 10);
+        }
+        if (found == 0) continue;
+        qsort(values, found, sizeof(values[0]), compare_int64);
+        printf("%-18s %6zu %8lld %8lld\n", g_timing_keys[k], found,
+               (long long)values[(found * 50 + 99) / 100 - 1], (long long)values[(found * 95 + 99) / 100 - 1]);
+    }
+    return 0;
 }
 
 // Signal handler
 static void signal_handler(int sig) {
-    g_stop_recording = 1;
+    request_stop();
+    if (sig != SIGUSR1) g_daemon_quit = 1;
 }
 
 // Check if already running
@@ -555,43 +5025,498 @@ static pid_t check_running() {
     return 0;
 }
 
+static Session *session_new(void) {
+    Session *s = calloc(1, sizeof(Session));
+    if (!s) return NULL;
+    pthread_mutex_init(&s->stream.queue.lock, NULL);
+    pthread_mutex_init(&s->segments.lock, NULL);
+    s->timing.trigger = g_trigger_ms;
+    return s;
+}
+
+static void session_free(Session *s) {
+    encoder_free(s->encoder);
+    audio_store_free(&s->audio);
+    pthread_mutex_destroy(&s->stream.queue.lock);
+    pthread_mutex_destroy(&s->segments.lock);
+    free(s);
+}
+
+// Transcripts go out in recording order: a short dictation finishing early waits
+// for the longer one before it
+static void session_wait_turn(const Session *s) {
+    pthread_mutex_lock(&g_session_lock);
+    while (g_delivered_seq + 1 < s->seq) pthread_cond_wait(&g_session_cond, &g_session_lock);
+    pthread_mutex_unlock(&g_session_lock);
+}
+
+static void session_done(const Session *s) {
+    pthread_mutex_lock(&g_session_lock);
+    g_delivered_seq = s->seq;
+    pthread_cond_broadcast(&g_session_cond);
+    pthread_mutex_unlock(&g_session_lock);
+}
+
+// One recording from first sample to clipboard, on the daemon's open source if there
+// is one. The capture device is handed back as soon as the recording ends, so in
+// daemon mode the next session can start while this one is still uploading.
+static void run_session(void) {
+    Session *s = session_new();
+    if (!s) {
+        fprintf(stderr, "Out of memory for a new session\n");
+        g_session_state = SESSION_IDLE;
+        return;
+    }
+    s->seq = atomic_fetch_add(&g_session_seq, 1) + 1;
+    g_session = s;
+    g_stop_recording = 0;
+    atomic_store(&g_stop_ms, 0);
+    vad_reset(&g_vad);
+
+    // Initialize start time BEFORE threads start
+    atomic_store_explicit(&g_record_start_ms, monotonic_ms(), memory_order_release);
+
+    // Map the status page the overlay reads; a replay runs headless
+    if (!g_replay.pcm && status_open() < 0) {
+        fprintf(stderr, "Cannot create status page: %s\n", strerror(errno));
+    }
+
+    // Show connecting status
+    update_status(STATUS_CONNECTING, NULL);
+
+    if (g_backend->remote) {
+        // Get DNS, TCP and TLS out of the way while the user is still talking
+        if (!g_stream_upload || g_segment_seconds > 0) start_warmup(s);
+
+        // Compress as we record unless segments are encoded one by one on the worker
+        if (g_segment_seconds == 0) s->encoder = encoder_new(g_upload_format);
+
+        // Open the upload right away so the request body follows the recording;
+        // segmented mode instead sends each closed piece as soon as it is cut
+        if (g_segment_seconds > 0) start_segment_pipeline(s);
+        else if (g_stream_upload) start_stream_upload(s);
+    }
+
+    // Start recording thread FIRST (no delay)
+    pthread_create(&g_record_thread, NULL, recording_thread, NULL);
+
+    // A local model evicted while idle is paged back in during the recording
+    start_backend_load();
+
+    // Then the overlay; the daemon's is already up and just needs to notice the new state
+    if (g_overlay_persistent) ensure_overlay();
+    else if (!g_replay.pcm) spawn_overlay(0);
+
+    // Wait for recording thread
+    pthread_join(g_record_thread, NULL);
+    g_session_state = SESSION_PROCESSING;
+    s->timing.captured = monotonic_ms();
+    s->timing.stop = atomic_load(&g_stop_ms);
+
+    if (g_vad_enabled) vad_finish(&g_vad);
+
+    // Capture is free for the next session; from here on this one only touches its own state
+    pthread_mutex_lock(&g_session_lock);
+    g_session = NULL;
+    pthread_mutex_unlock(&g_session_lock);
+    g_session_state = SESSION_IDLE;
+
+    // Flush the encoder, then end the request body; the server can start on it while the UI catches up
+    if (s->encoder) {
+        if (s->encoder->type->finish(s->encoder) == 0) {
+            forward_encoded(s);
+        } else {
+            encoder_free(s->encoder);
+            s->encoder = NULL;
+            if (s->stream.active) stream_queue_close(&s->stream.queue, 1);
+        }
+    }
+    if (s->stream.active) stream_queue_close(&s->stream.queue, 0);
+    s->timing.encoded = monotonic_ms();
+    s->timing.audio_ms = s->audio.size / sizeof(short) * 1000 / SAMPLE_RATE;
+
+    // State changes are only notifications: the overlay polls the page and draws
+    // whatever it finds, so nothing here waits for it. A newer session owns the
+    // page once it starts; this one then finishes silently.
+    session_status(s, STATUS_PROCESSING, NULL);
+
+    // Process audio
+    const char *outcome = "failed";
+    if (s->audio.size > 0) {
+        // The same recording transcribed before needs no request at all
+        uint64_t cache_key = g_transcript_cache > 0 ? transcript_cache_key(&s->audio) : 0;
+        char *transcription = cache_key ? transcript_cache_get(cache_key) : NULL;
+        int cached = transcription != NULL;
+        int ret = 0;
+        if (cached) {
+            finish_stream_upload(s, 1, NULL);
+            finish_segment_pipeline(s, 1, NULL);
+        } else {
+            session_status(s, g_backend->remote ? STATUS_UPLOADING : STATUS_TRANSCRIBING, NULL);
+
+            finish_backend_load();
+            ret = s->segments.active ? finish_segment_pipeline(s, 0, &transcription)
+                                     : finish_stream_upload(s, 0, &transcription);
+            if (ret != 0) {
+                free(transcription);
+                transcription = NULL;
+                // Streaming/segmenting disabled or failed: transcribe the complete recording instead
+                if (s->encoder) {
+                    ret = transcribe_audio(s->encoder->out.data, s->encoder->out.size, s->encoder->type,
+                                           &s->timing, &transcription);
+                } else {
+                    ret = backend_transcribe(&s->audio, &s->timing, &transcription);
+                }
+            }
+        }
+
+        session_wait_turn(s);
+        if (ret == 0 && transcription) {
+            s->timing.transcribed = monotonic_ms();
+            if (cache_key && !cached) transcript_cache_put(cache_key, transcription);
+            if (g_overlay_persistent) remember_transcript(transcription);
+            if (session_in_front(s)) status_set_partial(transcription); // shown while the result lingers
+            if (g_replay.pcm) {
+                g_replay.result = transcription; // reported instead of copied
+                transcription = NULL;
+            } else {
+                output_transcript(transcription);
+            }
+            s->timing.clipboard = monotonic_ms();
+            if (g_history && !g_replay.pcm) {
+                uint64_t stop = s->timing.stop ? s->timing.stop : s->timing.captured;
+                history_append(transcription, time(NULL), s->timing.audio_ms, s->timing.clipboard - stop, 0);
+            }
+            session_status(s, STATUS_COPIED, NULL);
+            outcome = cached ? "cached" : "copied";
+            if (g_spool_pending && g_spool_running) spool_kick(); // back online: send the backlog
+            free(transcription);
+        } else if (ret > 0 && g_backend->remote && g_spool_enabled &&
+                   spool_write(s->encoder, &s->audio) == 0) {
+            // Nothing is lost: the daemon delivers it once the API is reachable again.
+            // A rejection (bad key, bad request) would only fail again, so it isn't kept.
+            session_status(s, STATUS_SPOOLED, NULL);
+            outcome = "spooled";
+        } else {
+            session_status(s, STATUS_FAILED, NULL);
+        }
+    } else {
+        finish_stream_upload(s, 1, NULL);
+        finish_segment_pipeline(s, 1, NULL);
+        session_wait_turn(s);
+        session_status(s, STATUS_NO_AUDIO, NULL);
+        outcome = "no_audio";
+    }
+    session_done(s);
+
+    finish_backend_load();
+    finish_warmup(s);
+    if (g_replay.pcm) replay_report(s, outcome);
+    else timing_log_write(s, outcome);
+    session_free(s);
+
+    // The result stays on the page for the overlay to linger on (it times that itself);
+    // the daemon keeps the page mapped for the next session, one-shot runs unlink it
+    // and leave the overlay its own mapping
+    if (!g_overlay_persistent) status_close(1);
+}
+
+// Send one command to a running daemon; returns -1 if none is listening
+static int send_daemon_command(const char *cmd) {
+    const char *path = control_socket_path();
+    if (!path) return -1;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char reply[64];
+    ssize_t n = -1;
+    if (write(fd, cmd, strlen(cmd)) == (ssize_t)strlen(cmd)) {
+        n = read(fd, reply, sizeof(reply) - 1);
+    }
+    close(fd);
+    if (n <= 0) return -1;
+    reply[n] = '\0';
+    printf("%s", reply);
+    return 0;
+}
+
+static int open_control_socket(void) {
+    const char *path = control_socket_path();
+    if (!path) return -1;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path); // stale socket from a daemon that didn't exit cleanly
+
+    // Created 0600 rather than chmod'ed after bind, so it is never reachable by others
+    mode_t old_mask = umask(0177);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || listen(fd, 4) < 0) {
+        fprintf(stderr, "Cannot create control socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *daemon_session_thread(void *arg) {
+    (void)arg;
+    // Reopen lazily if the device was missing at startup or went away
+    if (!g_capture && capture_open() == 0) start_preroll_capture();
+    run_session();
+
+    pthread_mutex_lock(&g_session_lock);
+    g_sessions_active--;
+    pthread_cond_broadcast(&g_session_cond);
+    pthread_mutex_unlock(&g_session_lock);
+    return NULL;
+}
+
+// Start the next recording on its own detached thread; earlier sessions may still
+// be uploading, up to SESSION_SLOTS in all
+static const char *start_daemon_session(void) {
+    pthread_mutex_lock(&g_session_lock);
+    int full = g_sessions_active >= SESSION_SLOTS;
+    if (!full) g_sessions_active++;
+    pthread_mutex_unlock(&g_session_lock);
+    if (full) return "busy\n";
+
+    g_trigger_ms = monotonic_ms();
+    g_session_state = SESSION_RECORDING;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int ok = pthread_create(&thread, &attr, daemon_session_thread, NULL) == 0;
+    pthread_attr_destroy(&attr);
+    if (ok) return "recording\n";
+
+    g_session_state = SESSION_IDLE;
+    pthread_mutex_lock(&g_session_lock);
+    g_sessions_active--;
+    pthread_mutex_unlock(&g_session_lock);
+    return "error\n";
+}
+
+static int daemon_sessions_active(void) {
+    pthread_mutex_lock(&g_session_lock);
+    int active = g_sessions_active;
+    pthread_mutex_unlock(&g_session_lock);
+    return active;
+}
+
+// Handle one control command; the reply is written back to the client
+static const char *handle_daemon_command(const char *cmd) {
+    if (strncmp(cmd, "toggle", 6) == 0) {
+        if (g_session_state == SESSION_RECORDING) {
+            request_stop();
+            return "stopped\n";
+        }
+        // Between the end of capture and handing the device back
+        if (g_session_state == SESSION_PROCESSING) return "busy\n";
+        return start_daemon_session();
+    }
+    if (strncmp(cmd, "quit", 4) == 0) {
+        g_daemon_quit = 1;
+        request_stop();
+        return "quitting\n";
+    }
+    if (strncmp(cmd, "recopy", 6) == 0) return recopy_transcript() == 0 ? "copied\n" : "empty\n";
+    if (strncmp(cmd, "ping", 4) == 0) return "ok\n";
+    return "unknown command\n";
+}
+
+static void run_daemon(int listen_fd) {
+    // Pay for device setup and curl init once instead of on every hotkey press
+    if (capture_open() == 0) start_preroll_capture();
+    g_curl = curl_easy_init();
+
+    // Deliver recordings left over from earlier failures, now and whenever we get back online
+    start_spool_worker();
+
+    // Load a local model up front so the first recording doesn't wait for it
+    if (g_backend->load && g_backend->load() != 0) fprintf(stderr, "Backend %s failed to load\n", g_backend->name);
+    g_backend_used_ms = monotonic_ms();
+
+    // Start the overlay now so it is already mapped and hidden when the hotkey is pressed
+    g_overlay_persistent = 1;
+    if (status_open() == 0) ensure_overlay();
+
+#ifdef HAVE_WAYLAND
+    // Own the clipboard from here on instead of starting wl-copy for every result
+    wayland_start();
+#endif
+
+    while (!g_daemon_quit) {
+        // Give the model's memory back after a long idle; the next recording reloads it
+        if (g_backend->evict && g_backend_idle_minutes > 0 && daemon_sessions_active() == 0 &&
+            g_backend_used_ms && monotonic_ms() - g_backend_used_ms > g_backend_idle_minutes * 60000ULL) {
+            pthread_mutex_lock(&g_backend_lock);
+            g_backend->evict();
+            g_backend_used_ms = 0;
+            pthread_mutex_unlock(&g_backend_lock);
+        }
+
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) <= 0) continue; // wake periodically to notice signals
+
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        char cmd[64];
+        ssize_t n = read(fd, cmd, sizeof(cmd) - 1);
+        if (n > 0) {
+            cmd[n] = '\0';
+            const char *reply = handle_daemon_command(cmd);
+            write(fd, reply, strlen(reply));
+        }
+        close(fd);
+    }
+
+    // Let the sessions in progress finish delivering their transcripts
+    g_stop_recording = 1;
+    pthread_mutex_lock(&g_session_lock);
+    while (g_sessions_active > 0) pthread_cond_wait(&g_session_cond, &g_session_lock);
+    pthread_mutex_unlock(&g_session_lock);
+    stop_spool_worker();
+    if (g_preroll_running) pthread_join(g_preroll_thread, NULL);
+    free(g_preroll.samples);
+
+    close(listen_fd);
+    unlink(control_socket_path());
+    stop_overlay();
+#ifdef HAVE_WAYLAND
+    wayland_stop();
+#endif
+    status_close(1);
+    if (g_backend->unload) g_backend->unload();
+    capture_close();
+    if (g_curl) curl_easy_cleanup(g_curl);
+}
+
 int main(int argc, char **argv) {
-    // Check if another instance is running
-    pid_t existing_pid = check_running();
-    if (existing_pid > 0) {
-        // Send signal to stop recording
-        kill(existing_pid, SIGUSR1);
-        return 0;
+    g_trigger_ms = monotonic_ms();
+    int daemon_mode = argc > 1 && strcmp(argv[1], "--daemon") == 0;
+    const char *replay_path = argc > 2 && strcmp(argv[1], "--replay") == 0 ? argv[2] : NULL;
+
+    if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+        return print_stats();
     }
 
-    // Don't write PID yet - will do after fork
+    if (argc > 1 && strcmp(argv[1], "--history") == 0) {
+        return print_history(argc > 2 ? atoi(argv[2]) : HISTORY_ROWS);
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--search") == 0) {
+        return search_history(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--quit") == 0) {
+        return send_daemon_command("quit") == 0 ? 0 : 1;
+    }
 
-    // Create status file
-    g_status_file = fopen(STATUSFILE, "w");
-    if (!g_status_file) {
-        fprintf(stderr, "Cannot create status file\n");
+    if (argc > 1 && strcmp(argv[1], "--recopy") == 0) {
+        // Without a daemon the newest cache entry is the last transcript
+        if (send_daemon_command("recopy") == 0) return 0;
+        if (recopy_transcript() == 0) return 0;
+        fprintf(stderr, "No transcript to copy\n");
+        return 1;
+    }
+
+    if (daemon_mode) {
+        if (send_daemon_command("ping") == 0) {
+            fprintf(stderr, "Daemon already running\n");
+            return 1;
+        }
+    } else if (!replay_path) {
+        // A running daemon owns the hotkey
+        if (send_daemon_command("toggle") == 0) return 0;
+
+        // Check if another instance is running
+        pid_t existing_pid = check_running();
+        if (existing_pid > 0) {
+            // Send signal to stop recording
+            kill(existing_pid, SIGUSR1);
+            return 0;
+        }
     }
 
+    // Don't write PID yet - will do after fork
+
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     signal(SIGUSR1, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    g_capture_ring.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    dsp_init(NULL);
 
     // Load API key
     load_env();
-    if (!g_api_key) {
+    if (replay_path) {
+        // Benchmark run: --replay FILE.wav [--fast] [KEY=VALUE ...] overriding .env
+        for (int i = 3; i < argc; i++) {
+            char *value = strchr(argv[i], '=');
+            if (strcmp(argv[i], "--fast") == 0) {
+                g_replay.realtime = 0;
+            } else if (value) {
+                *value++ = '\0';
+                apply_setting(argv[i], value);
+            }
+        }
+        if (replay_load(replay_path, &g_replay) < 0) return 1;
+        g_replay.path = replay_path;
+        g_spool_enabled = 0;
+    }
+    if (!g_backend) g_backend = &g_backends[0];
+    if (g_live_transcript && g_segment_seconds == 0) g_segment_seconds = LIVE_SEGMENT_SECONDS;
+    if (!g_api_key && g_backend->remote) {
         fprintf(stderr, "OPENAI_API_KEY not found in .env\n");
-        unlink(PIDFILE);
-        if (g_status_file) fclose(g_status_file);
+        return 1;
+    }
+
+    int listen_fd = -1;
+    if (daemon_mode && (listen_fd = open_control_socket()) < 0) {
         return 1;
     }
 
     // Initialize CURL
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    init_connection_share();
+
+    if (replay_path) {
+        // Stay in the foreground; the report goes to stdout
+        g_trigger_ms = monotonic_ms();
+        run_session();
+        if (g_backend->unload) g_backend->unload();
+        int failed = g_replay.result == NULL;
+        free(g_replay.result);
+        free(g_replay.pcm);
+        free(g_api_key);
+        if (g_share) curl_share_cleanup(g_share);
+        curl_global_cleanup();
+        return failed;
+    }
 
     // Fork to background
     pid_t child_pid = fork();
     if (child_pid > 0) {
+        if (daemon_mode) {
+            printf("Daemon started (PID: %d)\n", child_pid);
+            return 0;
+        }
         // Parent: write child's PID and exit
         FILE *pf = fopen(PIDFILE, "w");
         if (pf) {
@@ -617,57 +5542,18 @@ int main(int argc, char **argv) {
         close(devnull);
     }
 
-    // Initialize start time BEFORE threads start
-    g_record_start_time = time(NULL);
-
-    // Show connecting status
-    update_status("CONNECTING", 0.0);
-
-    // Start recording thread FIRST (no delay)
-    pthread_create(&g_record_thread, NULL, recording_thread, NULL);
-
-    // Then start monitor/visualization (can take time to start)
-    pthread_create(&g_monitor_thread, NULL, monitor_thread, NULL);
-
-    // Wait for recording thread
-    pthread_join(g_record_thread, NULL);
-
-    // Update status to show we're processing
-    update_status("PROCESSING", 0.0);
-    usleep(200000); // Give UI time to update
-
-    g_stop_recording = 1; // Signal monitor thread to stop
-    pthread_join(g_monitor_thread, NULL);
-
-    // Process audio
-    if (g_audio_buffer.size > 0) {
-        update_status("UPLOADING", 0.0);
-        usleep(200000); // Give UI time to update
-
-        char *transcription = NULL;
-        if (transcribe_audio(g_audio_buffer.data, g_audio_buffer.size, &transcription) == 0 && transcription) {
-            copy_to_clipboard(transcription);
-            update_status("COPIED", 0.0);
-            usleep(1000000); // Show success for 1 second
-            free(transcription);
-        } else {
-            update_status("FAILED", 0.0);
-            usleep(2000000); // Show error for 2 seconds
-        }
+    if (daemon_mode) {
+        run_daemon(listen_fd);
     } else {
-        update_status("NO_AUDIO", 0.0);
-        usleep(2000000);
+        run_session();
+        if (g_backend->unload) g_backend->unload();
+        unlink(PIDFILE);
     }
 
     // Cleanup
-    free_audio_buffer(&g_audio_buffer);
     free(g_api_key);
+    if (g_share) curl_share_cleanup(g_share);
     curl_global_cleanup();
-    unlink(PIDFILE);
-    if (g_status_file) {
-        fclose(g_status_file);
-        unlink(STATUSFILE);
-    }
 
     return 0;
-}
\ No newline at end of file
+}